@@ -0,0 +1,70 @@
+#pragma once
+
+#include <cassert>
+#include <cstddef>
+#include <type_traits>
+#include <utility>
+
+using namespace std;
+
+/// Arena
+/// One aligned region holding all per-cell arrays of a grid. Arrays are
+/// carved out in order, each on its own cache line, and live as long as the
+/// arena; matrices built by `matrix` are views into it. The region comes
+/// zeroed from the kernel, which is the zero value of every numeric type
+/// the simulation uses.
+///
+/// A default-constructed arena only measures: it hands out null pointers
+/// and adds up the bytes, so the same allocation code first sizes the
+/// region and then fills it. Regions of at least `huge_page` bytes are
+/// aligned to it and ask for transparent huge pages.
+class Arena {
+public:
+    static constexpr size_t alignment = 64;
+    static constexpr size_t page = 4096;
+    static constexpr size_t huge_page = size_t(2) << 20;
+
+public:
+    Arena() = default;
+    explicit Arena(size_t bytes);
+    ~Arena();
+
+    Arena(Arena&& other) noexcept {*this = move(other);}
+    Arena& operator=(Arena&& other) noexcept;
+
+    template<typename T>
+    T* take(size_t count);
+
+    /// n x m matrix of type `Matrix` in the arena.
+    template<typename Matrix>
+    Matrix matrix(size_t n, size_t m) {
+        using T = remove_pointer_t<decltype(declval<Matrix&>().data())>;
+        return Matrix(n, m, take<T>(n * m));
+    }
+
+    char* data() {return base;}
+
+    /// Bytes handed out so far.
+    size_t size() const {return used;}
+
+private:
+    void release();
+
+private:
+    void*   mapping = nullptr;
+    size_t  mapped = 0;
+    char*   base = nullptr;
+    size_t  capacity = 0;
+    size_t  used = 0;
+};
+
+
+template<typename T>
+T* Arena::take(size_t count) {
+    static_assert(is_trivially_copyable_v<T> && alignof(T) <= alignment);
+    used = (used + alignment - 1) / alignment * alignment;
+    T* ans = base ? reinterpret_cast<T*>(base + used) : nullptr;
+    used += count * sizeof(T);
+    assert(!base || used <= capacity);
+    return ans;
+}
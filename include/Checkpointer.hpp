@@ -0,0 +1,56 @@
+#pragma once
+
+#include "Snapshot.hpp"
+
+#include <array>
+#include <condition_variable>
+#include <cstddef>
+#include <mutex>
+#include <string>
+#include <thread>
+
+using namespace std;
+
+/// Checkpointer
+/// Writes snapshots on a background thread. The simulation thread copies
+/// its state into one of two buffers at a tick boundary and continues; the
+/// writer computes the checksum, writes a temporary file and renames it
+/// over the target, so the target always holds a complete snapshot.
+///
+/// The simulation never waits: the buffer it fills is never the one being
+/// written, and a checkpoint not yet picked up is replaced by a newer one.
+class Checkpointer {
+public:
+    struct Slot {
+        SnapshotHeader  header{};
+        SnapshotWriter  payload;
+    };
+
+public:
+    explicit Checkpointer(string filename);
+    // Writes the pending checkpoint, if any, before returning.
+    ~Checkpointer();
+
+    Checkpointer(const Checkpointer&) = delete;
+    Checkpointer& operator=(const Checkpointer&) = delete;
+
+    /// Buffer to fill with the next checkpoint; pass it to `submit` after.
+    Slot& acquire();
+
+    void submit(Slot& slot);
+
+private:
+    void writer_loop();
+
+    static constexpr int none = -1;
+
+private:
+    string              filename;
+    array<Slot, 2>      slots;
+    mutex               mtx;
+    condition_variable  cv;
+    int                 ready = none;
+    int                 writing = none;
+    bool                stopping = false;
+    thread              writer;
+};
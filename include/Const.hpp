@@ -1,25 +1,99 @@
 #pragma once
 
+#include "FixedInner.hpp"
+
+#include <algorithm>
 #include <array>
+#include <cstdint>
 #include <random>
 #include <string>
 #include <string_view>
+#include <type_traits>
+#include <utility>
 
 using namespace std;
 
 constexpr array<pair<int, int>, 4> deltas{{{-1, 0}, {1, 0}, {0, -1}, {0, 1}}};
 
+/// Index of (dx, dy) in deltas; deltas.size() if it is not a direction.
+constexpr size_t dir_index(int dx, int dy) {
+    for (size_t i = 0; i < deltas.size(); ++i) {
+        if (deltas[i].first == dx && deltas[i].second == dy) {
+            return i;
+        }
+    }
+    return deltas.size();
+}
+
+/// opposite[i] is the index of -deltas[i].
+constexpr array<size_t, deltas.size()> opposite = [] {
+    array<size_t, deltas.size()> ans{};
+    for (size_t i = 0; i < deltas.size(); ++i) {
+        ans[i] = dir_index(-deltas[i].first, -deltas[i].second);
+    }
+    return ans;
+}();
+
+static_assert(ranges::all_of(opposite, [](size_t i) {return i < deltas.size();}));
+
+/// for_each_dir(f)
+/// Unrolled iteration over deltas: calls f(integral_constant<size_t, I>{})
+/// for every direction index I in order.
+template<typename F>
+constexpr void for_each_dir(F&& f) {
+    [&]<size_t... Is>(index_sequence<Is...>) {
+        (f(integral_constant<size_t, Is>{}), ...);
+    }(make_index_sequence<deltas.size()>{});
+}
+
 string to_lower_rm_space(string_view s);
 
+enum class RngMode {
+    // Counter-based draws keyed by (seed, tick, cell, draw).
+    Counter,
+    // The single global mt19937 stream; draw order defines the result.
+    Mt19937,
+};
+
 class Rnd {
 private:
     static mt19937 rnd;
     
 public:
+    static void seed(uint64_t s) {rnd.seed(s);}
+
     template<typename Type>
     static Type random01() {
         return Type(uniform_real_distribution<>{0, 1}(rnd));
     }
+
+    /// Counter-based generator: every draw is a pure function of a per-tick
+    /// key and a counter, so draws can be made in any order or in parallel.
+    static constexpr uint64_t mix(uint64_t z) {
+        z = (z ^ (z >> 30)) * 0xbf58476d1ce4e5b9;
+        z = (z ^ (z >> 27)) * 0x94d049bb133111eb;
+        return z ^ (z >> 31);
+    }
+
+    static constexpr uint64_t key(uint64_t seed, uint64_t tick) {
+        return mix(seed ^ mix(tick * 0x9e3779b97f4a7c15 + 1));
+    }
+
+    static constexpr uint64_t bits(uint64_t key, uint64_t counter) {
+        return mix(key + counter * 0x9e3779b97f4a7c15);
+    }
+
+    /// Uniform value in [0, 1) built directly in Type from the top bits.
+    template<typename Type>
+    static constexpr Type from_bits(uint64_t bits) {
+        if constexpr (IsFixedInner<Type>::value) {
+            return Type::from_raw(typename Type::type(bits >> (64 - Type::k)));
+        } else if constexpr (is_same_v<Type, float>) {
+            return float(bits >> 40) * 0x1.0p-24f;
+        } else {
+            return Type(double(bits >> 11) * 0x1.0p-53);
+        }
+    }
 };
 
 
@@ -0,0 +1,65 @@
+#pragma once
+
+#include "SpscQueue.hpp"
+
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+#include <string>
+#include <thread>
+
+using namespace std;
+
+enum class ControlCommand : uint8_t {
+    Snapshot,
+    Pause,
+    Resume,
+    RenderEvery,
+    Counters,
+    Stop,
+};
+
+struct ControlMessage {
+    ControlCommand  command = ControlCommand::Stop;
+    // Interval of RenderEvery.
+    size_t          value = 0;
+};
+
+/// ControlChannel
+/// Commands for a running simulation, read from a named pipe:
+///
+///     snapshot        save the state to savefile now
+///     pause, resume
+///     render K        print a frame at most every K ticks
+///     counters        print tick rate and traversal counters to stderr
+///     stop            stop as if the tick limit was reached
+///
+/// one per line, e.g. `echo pause > path`. A reader thread parses them and
+/// passes them to the simulation thread through a lock-free queue, which
+/// the simulation checks once per tick with a single relaxed load.
+class ControlChannel {
+public:
+    // Creates the pipe unless a pipe already exists at `path`; a created
+    // pipe is removed again by the destructor.
+    explicit ControlChannel(string path);
+    ~ControlChannel();
+
+    ControlChannel(const ControlChannel&) = delete;
+    ControlChannel& operator=(const ControlChannel&) = delete;
+
+    bool pending() const {return queue.maybe_nonempty();}
+
+    bool pop(ControlMessage& message) {return queue.try_pop(message);}
+
+private:
+    void reader_loop();
+    void parse(const string& line);
+
+private:
+    string                      path;
+    int                         fd = -1;
+    bool                        created = false;
+    atomic<bool>                stopping{false};
+    SpscQueue<ControlMessage>   queue{64};
+    thread                      reader;
+};
@@ -4,8 +4,22 @@
 #include "ParticleParams.hpp"
 #include "Matrix.hpp"
 #include "VectorField.hpp"
+#include "Topology.hpp"
+#include "Traversal.hpp"
+#include "ThreadPool.hpp"
+#include "FluidOptions.hpp"
+#include "Snapshot.hpp"
+#include "Checkpointer.hpp"
+#include "Output.hpp"
+#include "Recording.hpp"
+#include "Profiler.hpp"
+#include "TextFile.hpp"
+#include "Generation.hpp"
+#include "Control.hpp"
+#include "Arena.hpp"
 #include "Const.hpp"
 
+#include <cmath>
 #include <cstring>
 #include <cassert>
 #include <iostream>
@@ -15,7 +29,14 @@
 #include <fstream>
 #include <stdexcept>
 #include <string>
+#include <atomic>
+#include <chrono>
 #include <csignal>
+#include <thread>
+#include <cstdint>
+#include <limits>
+#include <utility>
+#include <vector>
 
 using namespace std;
 
@@ -23,39 +44,221 @@ using namespace std;
 template<typename PType, typename VType>
 class ParticleParams;
 
-template<typename PType, typename VType, typename VFType>
+template<typename PType, typename VType, typename VFType, typename Storage>
 class Fluid {
     private:
         static constexpr size_t max_ticks = 1'000'000;
+        // Cells per parallel chunk; fixed so results do not depend on threads.
+        static constexpr size_t grain = 1024;
+        // Rows per chunk when a text file is parsed.
+        static constexpr size_t text_grain = 32;
         using V_COMMON_TYPE = typename CommonTypeFixed<VType, VFType>::type;
+        // Type of a single pressure contribution in the kinetic phase.
+        using KINETIC_TYPE  = decltype((declval<VType>() - declval<VFType>()) * declval<PType>() / declval<uint8_t>());
+
+        template<typename T>
+        using matrix_t  = typename Storage::template matrix<T>;
+        using field_t   = typename Storage::template matrix<char, 1>;
 
         size_t  n, m;
+        // Generation of the last traversal sweep, see Generation.hpp.
         int     UT = 0;
         VType   g;
         PType   rho[256];
         size_t  start_tick = 0;
 
-        unique_ptr<AbstractMatrix<PType>>   p       = nullptr;
-        unique_ptr<AbstractMatrix<PType>>   old_p   = nullptr;
-        VectorField<VType>                  velocity;
-        VectorField<VFType>                 velocity_flow;
-
-        unique_ptr<AbstractMatrix<char>>    field   = nullptr;
-        unique_ptr<AbstractMatrix<int>>     last_use= nullptr;
-        unique_ptr<AbstractMatrix<int>>     dirs    = nullptr;
+        // Holds every per-cell array below that lives as long as the grid,
+        // see allocate_grid.
+        Arena                               arena;
+        matrix_t<PType>                     p;
+        matrix_t<PType>                     old_p;
+        VectorField<VType, Storage>         velocity;
+        // Zero between ticks: the flow only runs through moving cells, and
+        // recalculate_p clears every moving cell once it has read it.
+        VectorField<VFType, Storage>        velocity_flow;
+
+        field_t                             field;
+        matrix_t<stamp_t>                   last_use;
+        Topology<PType, Storage>            topology;
+        // Non-wall cells with a nonzero velocity component, rebuilt by the
+        // pressure phase; the only possible seeds for the flow and kinetic phases.
+        vector<uint32_t>                    moving;
+        vector<uint8_t>                     moving_flags;
+
+        // Pressure contributions of the kinetic phase by source cell and
+        // direction, gathered per target cell in serial order.
+        VectorField<KINETIC_TYPE, Storage>  kinetic_delta;
+        matrix_t<uint8_t>                   kinetic_mask;
+
+        PType                               total_delta_p = 0;
+        vector<PType>                       partial_delta_p;
+
+        // Explicit stacks for the depth-first traversals, sized to the grid.
+        struct flow_frame {
+            int             x, y;
+            size_t          d;
+            V_COMMON_TYPE   lim;
+            V_COMMON_TYPE   ret;
+            // A residual edge led to a cell that may still reach a cycle.
+            bool            blocked;
+        };
+        struct stop_frame {
+            int             x, y;
+            size_t          d;
+        };
+        struct move_frame {
+            int             x, y;
+            int             nx, ny;
+            bool            is_first;
+            // Random numbers drawn for this cell so far in the current tick.
+            uint8_t         draws;
+        };
+        FrameStack<flow_frame>              flow_stack;
+        // Rectangle [x0, x1) x [y0, y1) a bounded flow search may not leave.
+        struct flow_tile {
+            int             x0, y0, x1, y1;
+        };
+        FrameStack<stop_frame>              stop_stack;
+        FrameStack<move_frame>              move_stack;
+
+        // Tiled flow mode: tile rectangles, the moving cells of each tile
+        // and a private search stack per tile.
+        FlowMode                            flow_mode;
+        size_t                              flow_tile_size;
+        vector<flow_tile>                   flow_tiles;
+        vector<vector<uint32_t>>            flow_tile_cells;
+        vector<FrameStack<flow_frame>>      flow_tile_stacks;
+        vector<int>                         flow_tile_UT;
+        // Moving cells the flow sweeps still start searches from.
+        vector<uint32_t>                    flow_seeds;
+
+        // Dinic flow solver, per cell by index x * m + y: strongly
+        // connected component of the residual graph and Tarjan order, BFS
+        // level (Tarjan lowlink before that) and current direction, the
+        // last two valid for cells stamped with the current UT. flow_cycle
+        // is the length of the shortest residual cycle through the source.
+        FlowSolver                          flow_solver;
+        vector<uint32_t>                    flow_component;
+        vector<uint32_t>                    flow_order;
+        vector<uint32_t>                    flow_level;
+        vector<uint8_t>                     flow_arc;
+        vector<uint32_t>                    flow_queue;
+        uint32_t                            flow_cycle = 0;
 
         bool need_save;
         string save_filename;
-        // bool save_signal;
+        SaveFormat save_format;
+        size_t checkpoint_every;
+        // Background writer for binary checkpoints.
+        unique_ptr<Checkpointer> checkpointer;
+
+        unique_ptr<OutputSink> output;
+        size_t render_every;
+
+        // Changed cells are reported by ParticleParams::swap_with.
+        unique_ptr<Recorder> recorder;
+        bool record_full;
+
+        // Stop criteria, see FluidOptions.
+        size_t end_tick;
+        double time_limit;
+        size_t steady_ticks;
+        double steady_tol;
+        // Velocities at the end of the previous tick, kept for steady_ticks
+        // and dirty tiles.
+        VectorField<VType, Storage> prev_velocity;
+
+        // Fluid cells by square tile and the largest change of p or
+        // velocity in each tile during the last tick.
+        size_t                              change_tile_size;
+        size_t                              change_tile_cols;
+        vector<vector<uint32_t>>            change_tile_cells;
+        vector<double>                      tile_change;
+
+        // Dirty-tile mode: the force and pressure phases only visit the
+        // fluid cells of awake tiles, listed in `active`.
+        bool                                dirty_tiles;
+        double                              dirty_tol;
+        vector<uint8_t>                     tile_awake;
+        vector<uint32_t>                    active;
+        // Set while verification runs the reference sweep over all cells.
+        bool                                full_sweep = false;
+
+        // State a tick reads, saved to run a tick twice.
+        struct tick_state {
+            matrix_t<PType>                 p, old_p, rho;
+            VectorField<VType, Storage>     velocity;
+            field_t                         field;
+            matrix_t<stamp_t>               last_use;
+            int                             UT;
+        };
+        bool                                verify_tiles;
+        tick_state                          verify_before, verify_full;
+        size_t                              verify_ticks = 0;
+        size_t                              verify_diverged = 0;
+        size_t                              verify_field_cells = 0;
+        double                              verify_max_dev = 0;
+
+        unique_ptr<ControlChannel> control;
+
+        unique_ptr<Profiler> profiler;
+        // Updated by the phases on every tick, reported when profiling.
+        TickCounters counters;
+
+        ThreadPool pool;
+
+        RngMode             rng_mode;
+        uint64_t            seed;
+        // Counter-based generator key of the current tick.
+        uint64_t            tick_key = 0;
+        // First draw of every fluid cell in the move phase, filled per tick.
+        vector<double>      move_draws;
 
 
     public:
-        Fluid(const string& filename, bool need_save, const string& save_filename);
+        Fluid(const FluidOptions& opts);
 
         void run(); 
 
     private:
-        tuple<V_COMMON_TYPE, bool, pair<int, int>> propagate_flow(int x, int y, V_COMMON_TYPE lim);
+        // Grid bounds for the hot loops; constexpr under StaticStorage.
+        size_t rows() const {return p.get_n();}
+        size_t cols() const {return p.get_m();}
+
+        pair<size_t, size_t> cell_xy(uint32_t c) const {return {c / cols(), c % cols()};}
+
+        void apply_external_forces();
+
+        void apply_p_forces();
+
+        void make_flow();
+
+        void recalculate_p();
+
+        bool move_particles();
+
+        void make_flow_tiled();
+
+        void make_flow_dinic();
+
+        // Components of the residual graph reachable from flow_seeds.
+        void flow_components();
+
+        // Levels of the cells on shortest residual cycles through (x, y);
+        // false if there is no such cycle.
+        bool flow_levels(int x, int y);
+
+        // Saturates the shortest residual cycles through (x, y).
+        void flow_blocking(int x, int y);
+
+        // Largest flow the Dinic solver puts on an edge: the capacity,
+        // rounded down if VFType cannot hold it.
+        VFType flow_capacity(int x, int y, size_t d);
+
+        template<bool Bounded>
+        V_COMMON_TYPE propagate_flow(int x, int y, V_COMMON_TYPE lim, int UT, FrameStack<flow_frame>& flow_stack, const flow_tile& tile);
+
+        bool can_stop(int x, int y);
 
         void propagate_stop(int x, int y, bool force = false);
 
@@ -63,36 +266,82 @@ class Fluid {
 
         bool propagate_move(int x, int y, bool is_first);
 
+        template<typename T>
+        T random01(int x, int y, uint8_t draw);
+
+        template<typename F>
+        void profiled(ProfilePhase phase, F&& f);
+
+        void collect_counters();
+
+        double max_change();
+
+        // Runs the queued control commands at a tick boundary and waits
+        // while paused; false if the run has to stop.
+        bool handle_control(size_t tick, size_t& since_render, chrono::steady_clock::time_point start);
+
+        const vector<uint32_t>& sweep_cells() const {
+            return dirty_tiles && !full_sweep ? active : topology.fluid;
+        }
+
+        void update_awake_tiles();
+
+        bool step(size_t tick);
+
+        // Runs the tick over all cells and then with dirty tiles from the
+        // same state, keeps the latter and records the difference.
+        bool verify_step(size_t tick);
+
+        void save_state(tick_state& state);
+        void restore_state(const tick_state& state);
+
     private:
-        // void saveSignalOn(int _);
         void save_to_file(size_t tick);
+
+        // Binary checkpoints go to the background writer; the text export
+        // is written in place.
+        void checkpoint(size_t tick);
+
+        void capture_snapshot(size_t tick, SnapshotHeader& header, SnapshotWriter& out);
+        void record_keyframe(size_t tick, const FieldView& view);
+        void save_snapshot(size_t tick);
+        void read_snapshot(const string& filename);
         
-        void save_field(const AbstractMatrix<char>& field, ofstream& file);
-        void save_velocity(const AbstractMatrix<array<VType, deltas.size()>>& velocity, ofstream& file);
-        void save_last_use(const AbstractMatrix<int>& last_use, ofstream& file);
-        void save_p(const AbstractMatrix<PType>& p, ofstream& file);
+        void save_field(const field_t& field, ofstream& file);
+        void save_velocity(const VectorField<VType, Storage>& velocity, ofstream& file);
+        void save_last_use(const matrix_t<stamp_t>& last_use, ofstream& file);
+        void save_p(const matrix_t<PType>& p, ofstream& file);
         void save_RHO(const PType rho[256], ofstream& file);
 
-        void read_velocity(ifstream& file);
-        void read_last_use(ifstream& file);
-        void read_p(ifstream& file);
+        // Parses the next n lines in parallel, parse(i, line) for row i.
+        template<typename F>
+        void read_rows(TextFile& fin, const string& name, F&& parse);
+
+        void read_velocity(TextFile& file);
+        void read_last_use(TextFile& file);
+        void read_p(TextFile& file);
 
+        void read_NM(TextFile& fin);
 
-        bool read_line(ifstream& fin, string& line);
+        void read_field(TextFile& fin);
 
-        void read_NM(ifstream &fin);
+        void read_G(TextFile& fin);
 
-        void read_field(ifstream &fin);
+        void read_RHO(TextFile& fin);
 
-        void read_G(ifstream &fin);
+        // Places the per-cell arrays of an n x m grid in one arena.
+        void allocate_grid();
 
-        void read_RHO(ifstream &fin);
+        // Derived tables and buffers, once the grid is loaded.
+        void init(const FluidOptions& opts);
 
-        void read_default_file(ifstream& fin);
-        void read_save_file(ifstream& fin);
-        void read_main_data_from_savefile(ifstream& fin);
+        void read_default_file(TextFile& fin);
+        void read_save_file(TextFile& fin);
+        void read_main_data_from_savefile(TextFile& fin);
         
     friend ParticleParams<PType, VType>;
+    // Runs single phases for the benchmark in tools/bench.cpp.
+    friend struct BenchAccess;
 };
 
 
@@ -104,8 +353,8 @@ class Fluid {
 
 
 
-template<typename PType, typename VType, typename VFType>
-void Fluid<PType, VType, VFType>::save_field(const AbstractMatrix<char>& field, ofstream& file) {
+template<typename PType, typename VType, typename VFType, typename Storage>
+void Fluid<PType, VType, VFType, Storage>::save_field(const field_t& field, ofstream& file) {
     for (int i = 0; i < n; i++) {
         for (int j = 0; j < m; j++) {
             file << (field[i][j]);
@@ -114,19 +363,19 @@ void Fluid<PType, VType, VFType>::save_field(const AbstractMatrix<char>& field,
     }
 }
 
-template<typename PType, typename VType, typename VFType>
-void Fluid<PType, VType, VFType>::save_velocity(const AbstractMatrix<array<VType, deltas.size()>>& velocity, ofstream& file) {
+template<typename PType, typename VType, typename VFType, typename Storage>
+void Fluid<PType, VType, VFType, Storage>::save_velocity(const VectorField<VType, Storage>& velocity, ofstream& file) {
     for (int i = 0; i < n; i++) {
         for (int j = 0; j < m; j++) {
-            file << double(velocity[i][j][0]) << " " << double(velocity[i][j][1]) << " " << double(velocity[i][j][2]) << " "
-                 << double(velocity[i][j][3]) << " ";
+            file << double(velocity.row(0, i)[j]) << " " << double(velocity.row(1, i)[j]) << " " << double(velocity.row(2, i)[j]) << " "
+                 << double(velocity.row(3, i)[j]) << " ";
         }
         file << "\n";
     }
 }
 
-template<typename PType, typename VType, typename VFType>
-void Fluid<PType, VType, VFType>::save_RHO(const PType rho[256], ofstream& file){
+template<typename PType, typename VType, typename VFType, typename Storage>
+void Fluid<PType, VType, VFType, Storage>::save_RHO(const PType rho[256], ofstream& file){
     for(int i = 0; i < 256; ++i){
         if (double(rho[i]) != 0){
             string ans = "";
@@ -137,8 +386,8 @@ void Fluid<PType, VType, VFType>::save_RHO(const PType rho[256], ofstream& file)
     }
 }
 
-template<typename PType, typename VType, typename VFType>
-void Fluid<PType, VType, VFType>::save_last_use(const AbstractMatrix<int>& last_use, ofstream& file) {
+template<typename PType, typename VType, typename VFType, typename Storage>
+void Fluid<PType, VType, VFType, Storage>::save_last_use(const matrix_t<stamp_t>& last_use, ofstream& file) {
     for (int i = 0; i < n; i++) {
         for (int j = 0; j < m; j++) {
             file << (last_use[i][j]) << " ";
@@ -147,8 +396,8 @@ void Fluid<PType, VType, VFType>::save_last_use(const AbstractMatrix<int>& last_
     }
 }
 
-template<typename PType, typename VType, typename VFType>
-void Fluid<PType, VType, VFType>::save_p(const AbstractMatrix<PType>& p, ofstream& file) {
+template<typename PType, typename VType, typename VFType, typename Storage>
+void Fluid<PType, VType, VFType, Storage>::save_p(const matrix_t<PType>& p, ofstream& file) {
     for (int i = 0; i < n; i++) {
         for (int j = 0; j < m; j++) {
             file << (double(p[i][j])) << " ";
@@ -157,106 +406,197 @@ void Fluid<PType, VType, VFType>::save_p(const AbstractMatrix<PType>& p, ofstrea
     }
 }
 
-template<typename PType, typename VType, typename VFType>
-void Fluid<PType, VType, VFType>::read_velocity(ifstream& fin){
-    string line;
-    stringstream ss;
-
-    for (size_t i = 0; i < n; ++i) {
-        if (!read_line(fin, line)) {
-            throw runtime_error("Не удалось прочитать параметр velocity");
-        }
-        for (size_t j = 0; j < m; ++j) {
-            ss = stringstream{line};
-            double temp[4];
-            ss >> temp[0] >> temp[1] >> temp[2] >> temp[3];
-
-            (*velocity.v)[i][j][0] = VType(temp[0]);
-            (*velocity.v)[i][j][1] = VType(temp[1]);
-            (*velocity.v)[i][j][2] = VType(temp[2]);
-            (*velocity.v)[i][j][3] = VType(temp[3]);
+template<typename PType, typename VType, typename VFType, typename Storage>
+template<typename F>
+void Fluid<PType, VType, VFType, Storage>::read_rows(TextFile& fin, const string& name, F&& parse){
+    const string_view* rows = fin.take(n);
+    if (!rows) {
+        throw runtime_error("Не удалось прочитать параметр " + name);
+    }
+    atomic<bool> bad{false};
+    pool.parallel_for(n, text_grain, [&](size_t, size_t lo, size_t hi) {
+        for (size_t i = lo; i < hi && !bad.load(memory_order_relaxed); ++i) {
+            if (!parse(i, rows[i])) {
+                bad = true;
+            }
         }
+    });
+    if (bad) {
+        throw runtime_error("Неверная строка параметра " + name);
     }
 }
 
+template<typename PType, typename VType, typename VFType, typename Storage>
+void Fluid<PType, VType, VFType, Storage>::read_velocity(TextFile& fin){
+    read_rows(fin, "velocity", [&](size_t i, string_view line) {
+        TextRow row(line);
+        for (size_t j = 0; j < m; ++j) {
+            for (auto& plane : velocity.planes) {
+                if (!row.get(plane[i][j])) {
+                    return false;
+                }
+            }
+        }
+        return row.done();
+    });
+}
 
-template<typename PType, typename VType, typename VFType>
-void Fluid<PType, VType, VFType>::read_last_use(ifstream& fin){
-    string line;
-    stringstream ss;
-    for (size_t i = 0; i < n; ++i) {
-        if (!read_line(fin, line)) {
-            throw runtime_error("Не удалось прочитать параметр last_use");
+template<typename PType, typename VType, typename VFType, typename Storage>
+void Fluid<PType, VType, VFType, Storage>::read_last_use(TextFile& fin){
+    // Stamps only order traversal sweeps, and no sweep is running between
+    // ticks, so the saved ones are checked and restarted from 0; older
+    // saves hold values that do not fit in stamp_t.
+    read_rows(fin, "last_use", [&](size_t, string_view line) {
+        TextRow row(line);
+        for (size_t j = 0; j < m; ++j) {
+            int64_t stamp;
+            if (!row.get(stamp)) {
+                return false;
+            }
         }
+        return row.done();
+    });
+    UT = 0;
+}
+
+template<typename PType, typename VType, typename VFType, typename Storage>
+void Fluid<PType, VType, VFType, Storage>::read_p(TextFile& fin){
+    read_rows(fin, "P", [&](size_t i, string_view line) {
+        TextRow row(line);
         for (size_t j = 0; j < m; ++j) {
-            ss = stringstream{line};
-            int temp;
-            ss >> temp;
-            (*last_use)[i][j] = temp;
+            if (!row.get(p[i][j])) {
+                return false;
+            }
         }
+        return row.done();
+    });
+}
+
+template<typename PType, typename VType, typename VFType, typename Storage>
+void Fluid<PType, VType, VFType, Storage>::read_main_data_from_savefile(TextFile& fin){
+    string_view line;
+    if (!fin.next(line)) {
+        throw runtime_error("Не удалось прочитать главные параметры из файла сохранения");
+    }
+    TextRow row(line);
+    if (!row.get(n) || !row.get(m) || !row.get(start_tick) || !row.get(UT) || !row.get(g)) {
+        throw runtime_error("Не удалось прочитать главные параметры из файла сохранения");
     }
 }
 
-template<typename PType, typename VType, typename VFType>
-void Fluid<PType, VType, VFType>::read_p(ifstream& fin){
-    string line;
-    stringstream ss;
+template<typename PType, typename VType, typename VFType, typename Storage>
+void Fluid<PType, VType, VFType, Storage>::capture_snapshot(size_t tick, SnapshotHeader& header, SnapshotWriter& out){
+    header = SnapshotHeader{};
+    header.n = n;
+    header.m = m;
+    header.tick = tick;
+    header.UT = UT;
+    header.p_tag = snapshot_tag<PType>();
+    header.v_tag = snapshot_tag<VType>();
+
+    out.clear();
+    out.put(&g, 1);
+    out.put(rho, 256);
     for (size_t i = 0; i < n; ++i) {
-        if (!read_line(fin, line)) {
-            throw runtime_error("Не удалось прочитать параметр P");
-        }
+        out.put(field[i], m);
+    }
+    for (const auto& plane : velocity.planes) {
+        out.put(plane.data(), n * m);
+    }
+    out.put(last_use.data(), n * m);
+    out.put(p.data(), n * m);
+}
 
-        for (size_t j = 0; j < m; ++j) {
-            ss = stringstream{line};
-            double temp;
-            ss >> temp;
-            (*p)[i][j] = PType(temp);
-        }
+template<typename PType, typename VType, typename VFType, typename Storage>
+void Fluid<PType, VType, VFType, Storage>::record_keyframe(size_t tick, const FieldView& view){
+    if (!record_full) {
+        recorder->keyframe(tick, view);
+        return;
     }
+    static_assert(deltas.size() == 4);
+    const size_t p_bytes = n * m * sizeof(PType), v_bytes = n * m * sizeof(VType);
+    recorder->keyframe(tick, view, {
+        {p.data(), p_bytes},
+        {velocity.planes[0].data(), v_bytes},
+        {velocity.planes[1].data(), v_bytes},
+        {velocity.planes[2].data(), v_bytes},
+        {velocity.planes[3].data(), v_bytes},
+    });
 }
 
-template<typename PType, typename VType, typename VFType>
-void Fluid<PType, VType, VFType>::read_main_data_from_savefile(ifstream& fin){
-    stringstream ss;
-    string line;
+template<typename PType, typename VType, typename VFType, typename Storage>
+void Fluid<PType, VType, VFType, Storage>::save_snapshot(size_t tick){
+    SnapshotHeader header;
+    SnapshotWriter out;
+    capture_snapshot(tick, header, out);
+    out.write(save_filename, header);
+}
 
-    if (!read_line(fin, line)) {
-        throw runtime_error("Не удалось прочитать главные параметры из файла сохранения");
+template<typename PType, typename VType, typename VFType, typename Storage>
+void Fluid<PType, VType, VFType, Storage>::checkpoint(size_t tick){
+    if (!checkpointer) {
+        save_to_file(tick);
+        cerr << "Сохранено: тик " << tick << ", файл " << save_filename << endl;
+        return;
     }
-    ss = stringstream{line};
-    if (!(ss >> n) || !(ss >> m) || !(ss >> start_tick) || !(ss >> UT) || !(ss >> g)) {
-        throw runtime_error("Не удалось прочитать главные параметры из файла сохранения");
+    auto& slot = checkpointer->acquire();
+    capture_snapshot(tick, slot.header, slot.payload);
+    checkpointer->submit(slot);
+}
+
+template<typename PType, typename VType, typename VFType, typename Storage>
+void Fluid<PType, VType, VFType, Storage>::read_snapshot(const string& filename){
+    SnapshotReader in(filename);
+    n = in.header.n;
+    m = in.header.m;
+    start_tick = in.header.tick;
+    UT = in.header.UT;
+
+    allocate_grid();
+
+    in.get(&g, 1, in.header.v_tag);
+    in.get(rho, 256, in.header.p_tag);
+    for (size_t i = 0; i < n; ++i) {
+        in.get(field[i], m, {});
+    }
+    for (auto& plane : velocity.planes) {
+        in.get(plane.data(), n * m, in.header.v_tag);
     }
+    if (in.header.version == 1) {
+        // int32 stamps; restarted as in read_last_use.
+        in.skip(n * m * sizeof(int32_t));
+        UT = 0;
+    } else {
+        in.get(last_use.data(), n * m, {});
+    }
+    in.get(p.data(), n * m, in.header.p_tag);
 }
 
-template<typename PType, typename VType, typename VFType>
-void Fluid<PType, VType, VFType>::save_to_file(size_t tick){
+template<typename PType, typename VType, typename VFType, typename Storage>
+void Fluid<PType, VType, VFType, Storage>::save_to_file(size_t tick){
+    if (save_format == SaveFormat::Binary) {
+        save_snapshot(tick);
+        return;
+    }
     ofstream file(save_filename);
     if (!file.is_open()) {
         cout << "Error: can`t open file `" << save_filename << "`" << endl;
     }
     file << 1 << "\n";
     file << n << " " << m << " " << tick << " " << UT << " " << double(g) << "\n";
-    save_field(*field, file);
-    save_velocity(*(velocity.v), file);
-    save_last_use(*last_use, file);
-    save_p(*p, file); 
+    save_field(field, file);
+    save_velocity(velocity, file);
+    save_last_use(last_use, file);
+    save_p(p, file); 
     save_RHO(rho, file);
 }
 
 
-template<typename PType, typename VType, typename VFType>
-void Fluid<PType, VType, VFType>::read_save_file(ifstream& fin){
+template<typename PType, typename VType, typename VFType, typename Storage>
+void Fluid<PType, VType, VFType, Storage>::read_save_file(TextFile& fin){
     read_main_data_from_savefile(fin);
 
-    field.reset(create_matrix<char>{}(n, m + 1));
-    p.reset(create_matrix<PType>{}(n, m));
-    old_p.reset(create_matrix<PType>{}(n, m));
-    last_use.reset(create_matrix<int>{}(n, m));
-    dirs.reset(create_matrix<int>{}(n, m));
-
-    velocity = VectorField<VType>{n, m};
-    velocity_flow = VectorField<VFType>{n, m};
+    allocate_grid();
 
     read_field(fin);
     read_velocity(fin);
@@ -266,19 +606,12 @@ void Fluid<PType, VType, VFType>::read_save_file(ifstream& fin){
 }
 
 
-template<typename PType, typename VType, typename VFType>
-void Fluid<PType, VType, VFType>::read_default_file(ifstream& fin){
+template<typename PType, typename VType, typename VFType, typename Storage>
+void Fluid<PType, VType, VFType, Storage>::read_default_file(TextFile& fin){
     read_NM(fin);
 
-    field.reset(create_matrix<char>{}(n, m + 1));
-    p.reset(create_matrix<PType>{}(n, m));
-    old_p.reset(create_matrix<PType>{}(n, m));
-    last_use.reset(create_matrix<int>{}(n, m));
-    dirs.reset(create_matrix<int>{}(n, m));
-    
-    velocity = VectorField<VType>{n, m};
-    velocity_flow = VectorField<VFType>{n, m};
-    
+    allocate_grid();
+
     read_field(fin);
     
     read_G(fin);
@@ -287,245 +620,1123 @@ void Fluid<PType, VType, VFType>::read_default_file(ifstream& fin){
 }
 
 
-template<typename PType, typename VType, typename VFType>
-Fluid<PType, VType, VFType>::Fluid(const string& filename, bool need_save, const string& save_filename) {
-    ifstream fin(filename);
-    if (!fin) {
-        throw runtime_error("Не удалось открыть файл");
+template<typename PType, typename VType, typename VFType, typename Storage>
+Fluid<PType, VType, VFType, Storage>::Fluid(const FluidOptions& opts) : pool(opts.threads) {
+    if (is_snapshot_file(opts.filename)) {
+        read_snapshot(opts.filename);
+        init(opts);
+        return;
     }
 
+    TextFile fin(opts.filename);
+
     int save_or_default_file;
-    stringstream ss;
-    string line;
+    string_view line;
 
-    if (!read_line(fin, line)) {
+    if (!fin.next(line)) {
         throw runtime_error("Не удалось прочитать");
     }
-    ss = stringstream{line};
-    if (!(ss >> save_or_default_file)) {
+    if (!TextRow(line).get(save_or_default_file)) {
         throw runtime_error("Не удалось прочитать параметры N и M");
     }
 
     if(save_or_default_file == 0){read_default_file(fin);}
     else{read_save_file(fin);}
+    init(opts);
+}
+
+template<typename PType, typename VType, typename VFType, typename Storage>
+void Fluid<PType, VType, VFType, Storage>::allocate_grid() {
+    auto carve = [&](Arena& from) {
+        field = from.matrix<field_t>(n, m + 1);
+        p = from.matrix<matrix_t<PType>>(n, m);
+        old_p = from.matrix<matrix_t<PType>>(n, m);
+        last_use = from.matrix<matrix_t<stamp_t>>(n, m);
+        velocity = VectorField<VType, Storage>{n, m, from};
+        velocity_flow = VectorField<VFType, Storage>{n, m, from};
+        topology = Topology<PType, Storage>(n, m, from);
+        kinetic_delta = VectorField<KINETIC_TYPE, Storage>{n, m, from};
+        kinetic_mask = from.matrix<matrix_t<uint8_t>>(n, m);
+    };
+    // The same carving on an empty arena gives the size.
+    Arena sizing;
+    carve(sizing);
+    arena = Arena(sizing.size());
+    carve(arena);
+
+    // First touch: pages are placed on the NUMA node of the thread that
+    // writes them first, so the pool faults them in, one band per thread.
+    size_t pages = (arena.size() + Arena::page - 1) / Arena::page;
+    char* base = arena.data();
+    pool.parallel_for(pages, (pages + pool.size() - 1) / pool.size(), [&](size_t, size_t lo, size_t hi) {
+        for (size_t k = lo; k < hi; ++k) {
+            static_cast<volatile char*>(base)[k * Arena::page] = 0;
+        }
+    });
+}
 
-    this->need_save = need_save;
-    this->save_filename = save_filename;
+template<typename PType, typename VType, typename VFType, typename Storage>
+void Fluid<PType, VType, VFType, Storage>::init(const FluidOptions& opts) {
+    topology.build(field, rho, n, m);
+    moving.reserve(topology.fluid.size());
+    flow_seeds.reserve(topology.fluid.size());
+    flow_stack = FrameStack<flow_frame>(topology.fluid.size());
+    stop_stack = FrameStack<stop_frame>(topology.fluid.size());
+    move_stack = FrameStack<move_frame>(topology.fluid.size());
+    moving_flags.resize(topology.fluid.size());
+
+    rng_mode = opts.rng;
+    seed = opts.seed;
+    Rnd::seed(seed);
+    move_draws.resize(topology.fluid.size());
+
+    flow_mode = opts.flow_mode;
+    flow_tile_size = opts.flow_tile;
+    flow_solver = opts.flow_solver;
+    if (flow_solver == FlowSolver::Dinic) {
+        flow_component.resize(n * m);
+        flow_order.resize(n * m);
+        flow_level.resize(n * m);
+        flow_arc.resize(n * m);
+        flow_queue.reserve(topology.fluid.size());
+    }
+    if (flow_mode == FlowMode::Tiled) {
+        for (size_t x0 = 0; x0 < rows(); x0 += flow_tile_size) {
+            for (size_t y0 = 0; y0 < cols(); y0 += flow_tile_size) {
+                size_t x1 = min(x0 + flow_tile_size, rows()), y1 = min(y0 + flow_tile_size, cols());
+                flow_tiles.push_back({int(x0), int(y0), int(x1), int(y1)});
+                flow_tile_stacks.emplace_back((x1 - x0) * (y1 - y0));
+            }
+        }
+        flow_tile_cells.resize(flow_tiles.size());
+        flow_tile_UT.resize(flow_tiles.size());
+    }
+    // The pressure phase refreshes old_p only for non-wall cells.
+    copy_n(p.data(), p.size(), old_p.data());
+
+    this->need_save = opts.need_save;
+    this->save_filename = opts.save_filename;
+    this->save_format = opts.save_format;
+    this->checkpoint_every = opts.checkpoint_every;
+    this->output = make_output_sink(opts.output, opts.has_roi ? &opts.roi : nullptr, opts.output_queue, opts.output_policy);
+    this->render_every = opts.render_every;
+    this->record_full = opts.record_full;
+    end_tick = opts.max_ticks ? start_tick + opts.max_ticks : max_ticks;
+    time_limit = opts.time_limit;
+    steady_ticks = opts.steady_ticks;
+    steady_tol = opts.steady_tol;
+    dirty_tiles = opts.dirty_tiles;
+    dirty_tol = opts.dirty_tol;
+    verify_tiles = opts.verify_tiles;
+    if (steady_ticks || dirty_tiles) {
+        prev_velocity = VectorField<VType, Storage>{n, m};
+        for (size_t d = 0; d < deltas.size(); ++d) {
+            copy_n(velocity.planes[d].data(), velocity.planes[d].size(), prev_velocity.planes[d].data());
+        }
+        change_tile_size = opts.dirty_tile;
+        change_tile_cols = (cols() + change_tile_size - 1) / change_tile_size;
+        change_tile_cells.resize((rows() + change_tile_size - 1) / change_tile_size * change_tile_cols);
+        for (uint32_t c : topology.fluid) {
+            auto [x, y] = cell_xy(c);
+            change_tile_cells[x / change_tile_size * change_tile_cols + y / change_tile_size].push_back(c);
+        }
+        tile_change.assign(change_tile_cells.size(), 0.0);
+        tile_awake.assign(change_tile_cells.size(), 1);
+        active = topology.fluid;
+    }
+    if (verify_tiles) {
+        for (auto* state : {&verify_before, &verify_full}) {
+            state->p = matrix_t<PType>(n, m);
+            state->old_p = matrix_t<PType>(n, m);
+            state->rho = matrix_t<PType>(n, m);
+            state->velocity = VectorField<VType, Storage>{n, m};
+            state->field = field_t(n, m + 1);
+            state->last_use = matrix_t<stamp_t>(n, m);
+        }
+    }
+    if (!opts.control_path.empty()) {
+        control = make_unique<ControlChannel>(opts.control_path);
+    }
+    if (!opts.profile_filename.empty()) {
+        profiler = make_unique<Profiler>(opts.profile_filename);
+    }
+    if (!opts.record_filename.empty()) {
+        RecordingHeader header{};
+        header.n = n;
+        header.m = m;
+        header.keyframe_every = opts.record_keyframe;
+        header.start_tick = start_tick;
+        header.full_keyframes = record_full;
+        header.p_tag = snapshot_tag<PType>();
+        header.v_tag = snapshot_tag<VType>();
+        recorder = make_unique<Recorder>(opts.record_filename, header);
+    }
+    if (need_save && save_format == SaveFormat::Binary) {
+        checkpointer = make_unique<Checkpointer>(save_filename);
+    }
 }
 
-bool save_signal;
+// Set from signal handlers, checked once per tick.
+inline atomic<bool> save_signal{false};
+inline atomic<bool> stop_signal{false};
 
+inline void saveSignalOn(int) {
+    save_signal = true;
+}
 
-void saveSignalOn(int _) {
+inline void stopSignalOn(int) {
     save_signal = true;
+    stop_signal = true;
 }
 
-template<typename PType, typename VType, typename VFType>
-void Fluid<PType, VType, VFType>::run(){
+template<typename PType, typename VType, typename VFType, typename Storage>
+void Fluid<PType, VType, VFType, Storage>::run(){
+    // SIGINT saves and continues, SIGTERM saves and stops. Recording and
+    // profiling runs also stop on SIGTERM, so that their files get closed.
     if(need_save){
         signal(SIGINT, saveSignalOn);
     }
+    if(need_save || recorder || profiler){
+        signal(SIGTERM, stopSignalOn);
+    }
     save_signal = false;
+    stop_signal = false;
+
+    const FieldView view{field.data(), field.get_m(), rows(), cols()};
+    // A frame is due once something moved and render_every ticks passed.
+    bool changed = false;
+    size_t since_render = render_every;
+    auto start = chrono::steady_clock::now();
+    size_t quiet_ticks = 0;
+    const char* stop_reason = nullptr;
+
+    size_t i = start_tick;
+    for (; i < end_tick; ++i) {
+        if (control && control->pending() && !handle_control(i, since_render, start)) {
+            stop_reason = "команда stop";
+            break;
+        }
+        bool periodic = checkpoint_every != 0 && i != start_tick && (i - start_tick) % checkpoint_every == 0;
+        if ((save_signal.exchange(false) || periodic) && need_save) {
+            checkpoint(i);
+        }
+        if (stop_signal) {
+            break;
+        }
+        if (time_limit > 0 && chrono::duration<double>(chrono::steady_clock::now() - start).count() >= time_limit) {
+            stop_reason = "исчерпано время";
+            break;
+        }
 
-    for (size_t x = 0; x < n; ++x) {
-        for (size_t y = 0; y < m; ++y) {
-            if ((*field)[x][y] == '#')
-                continue;
-            for (auto [dx, dy] : deltas) {
-                (*dirs)[x][y] += ((*field)[x + dx][y + dy] != '#');
+        if (recorder && recorder->keyframe_due(i)) {
+            record_keyframe(i, view);
+        }
+
+        if (profiler) {
+            profiler->begin_tick(i);
+        }
+        bool prop = verify_tiles ? verify_step(i) : step(i);
+
+        if (recorder) {
+            recorder->end_tick(i, view, prop);
+        }
+
+        changed |= prop;
+        ++since_render;
+        if (changed && since_render >= render_every) {
+            profiled(ProfilePhase::Output, [&] {output->frame(i, view);});
+            changed = false;
+            since_render = 0;
+        }
+        if (profiler) {
+            collect_counters();
+            profiler->end_tick(counters);
+        }
+
+        if (steady_ticks || dirty_tiles) {
+            // Always measured, so that prev_velocity follows every tick.
+            double change = max_change();
+            if (dirty_tiles) {
+                update_awake_tiles();
+            }
+            quiet_ticks = !prop && change <= steady_tol ? quiet_ticks + 1 : 0;
+            if (steady_ticks && quiet_ticks >= steady_ticks) {
+                stop_reason = "состояние установилось";
+                ++i;
+                break;
             }
         }
     }
+    if (verify_tiles) {
+        cerr << "Проверка тайлов: расхождение в " << verify_diverged << " из " << verify_ticks << " тиков"
+             << ", наибольшее отклонение p и скорости " << verify_max_dev
+             << ", несовпавших клеток поля " << verify_field_cells << endl;
+    }
+    if (i == end_tick) {
+        stop_reason = "достигнут предел тиков";
+    }
+    if (stop_reason) {
+        cerr << "Остановка на тике " << i << ": " << stop_reason << endl;
+        if (need_save) {
+            checkpoint(i);
+        }
+    }
+    output->finish(i - start_tick, rows() * cols(), chrono::steady_clock::now() - start);
+}
+
 
-    for (size_t i = start_tick; i < max_ticks; ++i) {
-        if(save_signal){
-            save_to_file(i);
-            cout << "SAAAAAVED" << endl;
-            save_signal = false;
-            cout << "Enter 0 to finish simulation and other key to continue: ";
-            string ans;
-            cin >> ans;
-            if(ans == "0") return;    
+
+template<typename PType, typename VType, typename VFType, typename Storage>
+template<typename F>
+void Fluid<PType, VType, VFType, Storage>::profiled(ProfilePhase phase, F&& f) {
+    if (!profiler) {
+        f();
+        return;
+    }
+    auto start = Profiler::clock::now();
+    f();
+    profiler->phase(phase, start, Profiler::clock::now());
+}
+
+template<typename PType, typename VType, typename VFType, typename Storage>
+void Fluid<PType, VType, VFType, Storage>::collect_counters() {
+    counters.dfs_nodes = flow_stack.pushes + stop_stack.pushes + move_stack.pushes;
+    counters.max_depth = max({flow_stack.peak, stop_stack.peak, move_stack.peak});
+    flow_stack.reset_stats();
+    stop_stack.reset_stats();
+    move_stack.reset_stats();
+    for (auto& stack : flow_tile_stacks) {
+        counters.dfs_nodes += stack.pushes;
+        counters.max_depth = max(counters.max_depth, stack.peak);
+        stack.reset_stats();
+    }
+    counters.total_delta_p = double(total_delta_p);
+}
+
+template<typename PType, typename VType, typename VFType, typename Storage>
+bool Fluid<PType, VType, VFType, Storage>::handle_control(size_t tick, size_t& since_render, chrono::steady_clock::time_point start) {
+    bool paused = false;
+    while (true) {
+        ControlMessage message;
+        if (!control->pop(message)) {
+            if (!paused) {
+                return true;
+            }
+            // Commands are rare while paused, a short sleep is enough.
+            // SIGTERM ends the pause and is handled by run as usual.
+            this_thread::sleep_for(chrono::milliseconds(20));
+            if (stop_signal) {
+                return true;
+            }
+            if (save_signal.exchange(false) && need_save) {
+                checkpoint(tick);
+            }
+            continue;
         }
+        switch (message.command) {
+            case ControlCommand::Snapshot:
+                if (need_save) {
+                    checkpoint(tick);
+                } else {
+                    cerr << "Команда snapshot требует опцию savefile" << endl;
+                }
+                break;
+            case ControlCommand::Pause:
+                if (!paused) {
+                    cerr << "Пауза на тике " << tick << endl;
+                }
+                paused = true;
+                break;
+            case ControlCommand::Resume:
+                if (paused) {
+                    cerr << "Продолжение с тика " << tick << endl;
+                }
+                paused = false;
+                break;
+            case ControlCommand::RenderEvery:
+                render_every = message.value;
+                since_render = min(since_render, render_every);
+                break;
+            case ControlCommand::Counters: {
+                collect_counters();
+                double elapsed = chrono::duration<double>(chrono::steady_clock::now() - start).count();
+                cerr << "Тик " << tick << ": тиков/с " << double(tick - start_tick) / max(elapsed, 1e-9)
+                     << ", проходов потока " << counters.flow_sweeps
+                     << ", перемещено " << counters.moved
+                     << ", total_delta_p " << counters.total_delta_p
+                     << ", вершин обходов " << counters.dfs_nodes
+                     << ", наибольшая глубина " << counters.max_depth << endl;
+                break;
+            }
+            case ControlCommand::Stop:
+                return false;
+        }
+    }
+}
 
+template<typename PType, typename VType, typename VFType, typename Storage>
+bool Fluid<PType, VType, VFType, Storage>::step(size_t tick) {
+    total_delta_p = 0;
+    tick_key = Rnd::key(seed, tick);
+    profiled(ProfilePhase::ExternalForces, [&] {apply_external_forces();});
+    profiled(ProfilePhase::PForces, [&] {apply_p_forces();});
+    profiled(ProfilePhase::Flow, [&] {make_flow();});
+    profiled(ProfilePhase::RecalculateP, [&] {recalculate_p();});
+    bool prop = false;
+    profiled(ProfilePhase::Move, [&] {prop = move_particles();});
+    return prop;
+}
 
-        PType total_delta_p = 0;
-        // Apply external forces
-        for (size_t x = 0; x < n; ++x) {
-            for (size_t y = 0; y < m; ++y) {
-                if ((*field)[x][y] == '#')
-                    continue;
-                if ((*field)[x + 1][y] != '#')
-                    velocity.add(x, y, 1, 0, g);
+template<typename PType, typename VType, typename VFType, typename Storage>
+void Fluid<PType, VType, VFType, Storage>::save_state(tick_state& state) {
+    auto save = [](const auto& from, auto& to) {copy_n(from.data(), from.size(), to.data());};
+    save(p, state.p);
+    save(old_p, state.old_p);
+    save(topology.rho, state.rho);
+    for (size_t d = 0; d < deltas.size(); ++d) {
+        save(velocity.planes[d], state.velocity.planes[d]);
+    }
+    save(field, state.field);
+    save(last_use, state.last_use);
+    state.UT = UT;
+}
+
+template<typename PType, typename VType, typename VFType, typename Storage>
+void Fluid<PType, VType, VFType, Storage>::restore_state(const tick_state& state) {
+    auto restore = [](const auto& from, auto& to) {copy_n(from.data(), from.size(), to.data());};
+    restore(state.p, p);
+    restore(state.old_p, old_p);
+    restore(state.rho, topology.rho);
+    for (size_t d = 0; d < deltas.size(); ++d) {
+        restore(state.velocity.planes[d], velocity.planes[d]);
+    }
+    restore(state.field, field);
+    restore(state.last_use, last_use);
+    UT = state.UT;
+}
+
+template<typename PType, typename VType, typename VFType, typename Storage>
+bool Fluid<PType, VType, VFType, Storage>::verify_step(size_t tick) {
+    save_state(verify_before);
+    full_sweep = true;
+    step(tick);
+    full_sweep = false;
+    save_state(verify_full);
+    restore_state(verify_before);
+    bool prop = step(tick);
+
+    double dev = 0;
+    size_t field_cells = 0;
+    for (uint32_t c : topology.fluid) {
+        auto [x, y] = cell_xy(c);
+        dev = max(dev, fabs(double(p[x][y]) - double(verify_full.p[x][y])));
+        for (size_t d = 0; d < deltas.size(); ++d) {
+            dev = max(dev, fabs(double(velocity.planes[d][x][y]) - double(verify_full.velocity.planes[d][x][y])));
+        }
+        field_cells += field[x][y] != verify_full.field[x][y];
+    }
+    ++verify_ticks;
+    if (dev > 0 || field_cells) {
+        ++verify_diverged;
+    }
+    verify_max_dev = max(verify_max_dev, dev);
+    verify_field_cells += field_cells;
+    return prop;
+}
+
+template<typename PType, typename VType, typename VFType, typename Storage>
+double Fluid<PType, VType, VFType, Storage>::max_change() {
+    // old_p holds p as of the start of the tick, see apply_p_forces.
+    pool.parallel_for(change_tile_cells.size(), 1, [&](size_t, size_t lo, size_t hi) {
+        for (size_t t = lo; t < hi; ++t) {
+            double change = 0;
+            for (uint32_t c : change_tile_cells[t]) {
+                auto [x, y] = cell_xy(c);
+                change = max(change, fabs(double(p[x][y]) - double(old_p[x][y])));
+                for_each_dir([&](auto d) {
+                    auto& prev = prev_velocity.template get<d>(x, y);
+                    auto cur = velocity.template get<d>(x, y);
+                    change = max(change, fabs(double(cur) - double(prev)));
+                    prev = cur;
+                });
             }
+            tile_change[t] = change;
         }
+    });
+    return tile_change.empty() ? 0.0 : *ranges::max_element(tile_change);
+}
 
-        // Apply forces from p
-        *old_p = *p;
-        for (size_t x = 0; x < n; ++x) {
-            for (size_t y = 0; y < m; ++y) {
-                if ((*field)[x][y] == '#')
-                    continue;
-                for (auto [dx, dy] : deltas) {
-                    int nx = x + dx, ny = y + dy;
-                    if ((*field)[nx][ny] != '#' && (*old_p)[nx][ny] < (*old_p)[x][y]) {
-                        auto delta_p = (*old_p)[x][y] - (*old_p)[nx][ny];
-                        auto force = delta_p;
-                        auto &contr = velocity.get(nx, ny, -dx, -dy);
-                        if (contr * rho[(int) ((*field)[nx][ny])] >= force) {
-                            contr -= force / rho[(int) ((*field)[nx][ny])];
-                            continue;
-                        }
-                        force -= contr * rho[(int) ((*field)[nx][ny])];
-                        contr = 0;
-                        velocity.add(x, y, dx, dy, force / rho[(int) ((*field)[x][y])]);
-                        (*p)[x][y] -= force / (*dirs)[x][y];
-                        total_delta_p -= force / (*dirs)[x][y];
-                    }
+template<typename PType, typename VType, typename VFType, typename Storage>
+void Fluid<PType, VType, VFType, Storage>::update_awake_tiles() {
+    // A tile stays awake while it or any of its eight neighbours changes,
+    // so activity spreads one tile per tick.
+    size_t tile_rows = change_tile_cells.size() / change_tile_cols;
+    active.clear();
+    for (size_t tx = 0; tx < tile_rows; ++tx) {
+        for (size_t ty = 0; ty < change_tile_cols; ++ty) {
+            bool awake = false;
+            for (size_t nx = tx ? tx - 1 : 0; nx <= min(tx + 1, tile_rows - 1); ++nx) {
+                for (size_t ny = ty ? ty - 1 : 0; ny <= min(ty + 1, change_tile_cols - 1); ++ny) {
+                    awake |= tile_change[nx * change_tile_cols + ny] > dirty_tol;
                 }
             }
+            size_t t = tx * change_tile_cols + ty;
+            tile_awake[t] = awake;
+            if (awake) {
+                active.insert(active.end(), change_tile_cells[t].begin(), change_tile_cells[t].end());
+            }
         }
+    }
+}
 
-        // Make flow from velocities
-        velocity_flow.reset();
-        bool prop = false;
-        do {
-            UT += 2;
-            prop = 0;
-            for (size_t x = 0; x < n; ++x) {
-                for (size_t y = 0; y < m; ++y) {
-                    if ((*field)[x][y] != '#' && (*last_use)[x][y] != UT) {
-                        auto [t, local_prop, _] = propagate_flow(x, y, 1);
-                        if (t > 0) {
-                            prop = 1;
-                        }
+template<typename PType, typename VType, typename VFType, typename Storage>
+void Fluid<PType, VType, VFType, Storage>::apply_external_forces() {
+    // Only the +x plane is touched.
+    constexpr size_t down = dir_index(1, 0);
+    const auto& fluid = sweep_cells();
+    pool.parallel_for(fluid.size(), grain, [&](size_t, size_t lo, size_t hi) {
+        for (size_t i = lo; i < hi; ++i) {
+            auto [x, y] = cell_xy(fluid[i]);
+            if (topology.is_open(x, y, down))
+                velocity.template get<down>(x, y) += g;
+        }
+    });
+}
+
+template<typename PType, typename VType, typename VFType, typename Storage>
+void Fluid<PType, VType, VFType, Storage>::apply_p_forces() {
+    // Only p[x][y] of the current cell is written here, so the copy of the
+    // previous pressure is fused into the sweep after a buffer swap.
+    // Wall cells hold the same pressure in both buffers.
+    //
+    // The velocities of an edge are only changed by its endpoint with the
+    // higher old pressure, so cells can be processed in any order.
+    swap(p, old_p);
+    const auto& fluid = sweep_cells();
+    if (&fluid != &topology.fluid) {
+        // Sleeping tiles keep their pressure.
+        copy_n(old_p.data(), old_p.size(), p.data());
+    }
+    partial_delta_p.assign(ThreadPool::chunks(fluid.size(), grain), PType(0));
+    pool.parallel_for(fluid.size(), grain, [&](size_t k, size_t lo, size_t hi) {
+        PType delta_p_sum = 0;
+        for (size_t i = lo; i < hi; ++i) {
+            auto [x, y] = cell_xy(fluid[i]);
+            p[x][y] = old_p[x][y];
+            uint8_t open = topology.open[x][y];
+            for_each_dir([&](auto d) {
+                constexpr auto dx = deltas[d].first, dy = deltas[d].second;
+                int nx = x + dx, ny = y + dy;
+                if (((open >> d) & 1) && old_p[nx][ny] < old_p[x][y]) {
+                    auto delta_p = old_p[x][y] - old_p[nx][ny];
+                    auto force = delta_p;
+                    auto &contr = velocity.template get<opposite[d]>(nx, ny);
+                    auto nrho = topology.rho[nx][ny];
+                    if (contr * nrho >= force) {
+                        contr -= force / nrho;
+                        return;
                     }
+                    force -= contr * nrho;
+                    contr = 0;
+                    velocity.template get<d>(x, y) += force / topology.rho[x][y];
+                    p[x][y] -= force / topology.dirs[x][y];
+                    delta_p_sum -= force / topology.dirs[x][y];
                 }
-            }
-        } while (prop);
+            });
+        }
+        partial_delta_p[k] = delta_p_sum;
+    });
+    for (auto delta_p_sum : partial_delta_p) {
+        total_delta_p += delta_p_sum;
+    }
 
-        // Recalculate p with kinetic energy
-        for (size_t x = 0; x < n; ++x) {
-            for (size_t y = 0; y < m; ++y) {
-                if ((*field)[x][y] == '#')
-                    continue;
-                for (auto [dx, dy] : deltas) {
-                    auto old_v = velocity.get(x, y, dx, dy);
-                    auto new_v = velocity_flow.get(x, y, dx, dy);
-                    if (old_v > 0) {
-                        assert(new_v <= old_v);
-                        velocity.get(x, y, dx, dy) = new_v;
-                        auto force = (old_v - new_v) * rho[(int) ((*field)[x][y])];
-                        if ((*field)[x][y] == '.')
-                            force *= 0.8;
-                        if ((*field)[x + dx][y + dy] == '#') {
-                            (*p)[x][y] += force / (*dirs)[x][y];
-                            total_delta_p += force / (*dirs)[x][y];
-                        } else {
-                            (*p)[x + dx][y + dy] += force / (*dirs)[x + dx][y + dy];
-                            total_delta_p += force / (*dirs)[x + dx][y + dy];
-                        }
-                    }
+    // Sleeping tiles may still hold velocity, so all cells are checked.
+    const auto& all = topology.fluid;
+    pool.parallel_for(all.size(), grain, [&](size_t, size_t lo, size_t hi) {
+        for (size_t i = lo; i < hi; ++i) {
+            auto [x, y] = cell_xy(all[i]);
+            bool is_moving = false;
+            for_each_dir([&](auto d) {
+                is_moving |= (velocity.template get<d>(x, y) != 0);
+            });
+            moving_flags[i] = is_moving;
+        }
+    });
+    moving.clear();
+    for (size_t i = 0; i < all.size(); ++i) {
+        if (moving_flags[i])
+            moving.push_back(all[i]);
+    }
+}
+
+template<typename PType, typename VType, typename VFType, typename Storage>
+void Fluid<PType, VType, VFType, Storage>::make_flow() {
+    // A cell without velocity has no capacity, so seeding from it only
+    // stamps last_use and can be skipped. velocity_flow is already zero.
+    if (flow_mode == FlowMode::Tiled) {
+        make_flow_tiled();
+    }
+    // Seeds of the sweeps, in the order of `moving`. A settled cell is
+    // dropped for good: a search from it or through it can find no cycle,
+    // so skipping it leaves every augmenting path and the number of sweeps
+    // as they were.
+    flow_seeds.clear();
+    for (uint32_t c : moving) {
+        auto [x, y] = cell_xy(c);
+        if (last_use[x][y] != settled) {
+            flow_seeds.push_back(c);
+        }
+    }
+    counters.flow_sweeps = 0;
+    if (flow_solver == FlowSolver::Dinic) {
+        make_flow_dinic();
+    }
+    bool prop = flow_solver == FlowSolver::Dfs;
+    while (prop) {
+        ++counters.flow_sweeps;
+        UT = next_generation(UT, [&] {last_use.reset();});
+        prop = 0;
+        size_t kept = 0;
+        for (uint32_t c : flow_seeds) {
+            auto [x, y] = cell_xy(c);
+            if (last_use[x][y] < UT) {
+                if (propagate_flow<false>(x, y, 1, UT, flow_stack, {}) > 0) {
+                    prop = 1;
                 }
             }
+            if (last_use[x][y] != settled) {
+                flow_seeds[kept++] = c;
+            }
         }
+        flow_seeds.resize(kept);
+    }
 
-        UT += 2;
-        prop = false;
-        for (size_t x = 0; x < n; ++x) {
-            for (size_t y = 0; y < m; ++y) {
-                if ((*field)[x][y] != '#' && (*last_use)[x][y] != UT) {
-                    if (Rnd::random01<double>() < move_prob(x, y)) {
-                        prop = true;
-                        propagate_move(x, y, true);
-                    } else {
-                        propagate_stop(x, y, true);
+    // Settled cells are moving cells or their neighbours; later traversals
+    // must see an ordinary stamp of this phase.
+    for (uint32_t c : moving) {
+        auto [x, y] = cell_xy(c);
+        if (last_use[x][y] == settled) {
+            last_use[x][y] = UT;
+        }
+        for_each_dir([&](auto d) {
+            constexpr auto dx = deltas[d].first, dy = deltas[d].second;
+            if (topology.is_open(x, y, d) && last_use[x + dx][y + dy] == settled) {
+                last_use[x + dx][y + dy] = UT;
+            }
+        });
+    }
+}
+
+template<typename PType, typename VType, typename VFType, typename Storage>
+void Fluid<PType, VType, VFType, Storage>::make_flow_tiled() {
+    // Every tile first saturates the paths that stay inside it, using its
+    // own sequence of last_use stamps; tiles share no cells, so they run in
+    // parallel. The sequential sweep in make_flow then picks up the paths
+    // crossing tile borders.
+    for (auto& cells : flow_tile_cells) {
+        cells.clear();
+    }
+    size_t tiles_per_row = (cols() + flow_tile_size - 1) / flow_tile_size;
+    for (uint32_t c : moving) {
+        auto [x, y] = cell_xy(c);
+        flow_tile_cells[(x / flow_tile_size) * tiles_per_row + y / flow_tile_size].push_back(c);
+    }
+
+    pool.parallel_for(flow_tiles.size(), 1, [&](size_t, size_t lo, size_t hi) {
+        for (size_t t = lo; t < hi; ++t) {
+            const auto& tile = flow_tiles[t];
+            int tile_UT = UT;
+            bool prop = false;
+            do {
+                tile_UT = next_generation(tile_UT, [&] {
+                    for (int x = tile.x0; x < tile.x1; ++x) {
+                        fill(last_use[x] + tile.y0, last_use[x] + tile.y1, stamp_t(0));
+                    }
+                });
+                prop = false;
+                auto& cells = flow_tile_cells[t];
+                size_t kept = 0;
+                for (uint32_t c : cells) {
+                    auto [x, y] = cell_xy(c);
+                    if (last_use[x][y] < tile_UT) {
+                        if (propagate_flow<true>(x, y, 1, tile_UT, flow_tile_stacks[t], tile) > 0) {
+                            prop = true;
+                        }
+                    }
+                    if (last_use[x][y] != settled) {
+                        cells[kept++] = c;
                     }
                 }
-            }
+                cells.resize(kept);
+            } while (prop);
+            flow_tile_UT[t] = tile_UT;
         }
+    });
+    UT = *ranges::max_element(flow_tile_UT);
+}
 
-        if (prop) {
-            cout << "Tick " << i << ":\n";
-            for (size_t x = 0; x < n; ++x) {
-                cout << (*field)[x] << endl;
-            }
+template<typename PType, typename VType, typename VFType, typename Storage>
+void Fluid<PType, VType, VFType, Storage>::make_flow_dinic() {
+    // Flow from a cell back to itself is a circulation through it. Once no
+    // residual cycle passes through the source, none ever will again in
+    // this phase, as residual capacity only shrinks; the source is settled
+    // and later searches leave it out. After the last source the residual
+    // graph has no cycle, as after the DFS sweeps. A cycle never leaves a
+    // component, so a cell alone in its component has none from the start.
+    flow_components();
+    for (uint32_t c : flow_seeds) {
+        auto [x, y] = cell_xy(c);
+        if (last_use[x][y] == settled) {
+            continue;
         }
+        while (flow_levels(x, y)) {
+            ++counters.flow_sweeps;
+            flow_blocking(x, y);
+        }
+        last_use[x][y] = settled;
     }
 }
 
+template<typename PType, typename VType, typename VFType, typename Storage>
+void Fluid<PType, VType, VFType, Storage>::flow_components() {
+    // Iterative Tarjan. A cell is on the component stack (flow_queue)
+    // while its component is unassigned.
+    constexpr uint32_t open_component = numeric_limits<uint32_t>::max();
+    auto& lowlink = flow_level;
+    UT = next_generation(UT, [&] {last_use.reset();});
+    uint32_t order = 0;
+    flow_queue.clear();
+    auto visit = [&](int x, int y) {
+        uint32_t cell = x * cols() + y;
+        last_use[x][y] = UT;
+        flow_order[cell] = lowlink[cell] = order++;
+        flow_component[cell] = open_component;
+        flow_arc[cell] = 0;
+        flow_queue.push_back(cell);
+        flow_stack.push({x, y, 0, 0, 0, false});
+    };
+    for (uint32_t c : flow_seeds) {
+        auto [x, y] = cell_xy(c);
+        if (last_use[x][y] >= UT) {
+            continue;
+        }
+        visit(x, y);
+        while (!flow_stack.empty()) {
+            auto& f = flow_stack.top();
+            uint32_t cell = f.x * cols() + f.y;
+            bool pushed = false;
+            for (auto& d = flow_arc[cell]; d < deltas.size(); ++d) {
+                if (!topology.is_open(f.x, f.y, d) || !(velocity_flow.get(f.x, f.y, d) < flow_capacity(f.x, f.y, d))) {
+                    continue;
+                }
+                auto [dx, dy] = deltas[d];
+                int nx = f.x + dx, ny = f.y + dy;
+                uint32_t next = nx * cols() + ny;
+                if (last_use[nx][ny] < UT) {
+                    visit(nx, ny);
+                    pushed = true;
+                    break;
+                }
+                if (last_use[nx][ny] == UT && flow_component[next] == open_component) {
+                    lowlink[cell] = min(lowlink[cell], flow_order[next]);
+                }
+            }
+            if (pushed) {
+                continue;
+            }
+            if (lowlink[cell] == flow_order[cell]) {
+                uint32_t member;
+                size_t size = 0;
+                do {
+                    member = flow_queue.back();
+                    flow_queue.pop_back();
+                    flow_component[member] = flow_order[cell];
+                    ++size;
+                } while (member != cell);
+                if (size == 1) {
+                    last_use[f.x][f.y] = settled;
+                }
+            }
+            flow_stack.pop();
+            if (!flow_stack.empty()) {
+                auto& parent = flow_stack.top();
+                uint32_t up = parent.x * cols() + parent.y;
+                lowlink[up] = min(lowlink[up], lowlink[cell]);
+            }
+        }
+    }
+}
 
+template<typename PType, typename VType, typename VFType, typename Storage>
+bool Fluid<PType, VType, VFType, Storage>::flow_levels(int x, int y) {
+    UT = next_generation(UT, [&] {last_use.reset();});
+    uint32_t source = x * cols() + y;
+    uint32_t component = flow_component[source];
+    flow_cycle = 0;
+    flow_queue.clear();
+    flow_queue.push_back(source);
+    last_use[x][y] = UT;
+    flow_level[source] = 0;
+    flow_arc[source] = 0;
+    for (size_t head = 0; head < flow_queue.size(); ++head) {
+        auto [cx, cy] = cell_xy(flow_queue[head]);
+        uint32_t level = flow_level[flow_queue[head]];
+        // Cells further out are not on a shortest cycle.
+        if (flow_cycle && level + 1 >= flow_cycle) {
+            break;
+        }
+        for_each_dir([&](auto d) {
+            constexpr auto dx = deltas[d].first, dy = deltas[d].second;
+            if (!topology.is_open(cx, cy, d) || !(velocity_flow.template get<d>(cx, cy) < flow_capacity(cx, cy, d))) {
+                return;
+            }
+            int nx = cx + dx, ny = cy + dy;
+            uint32_t next = nx * cols() + ny;
+            if (next == source) {
+                if (!flow_cycle) {
+                    flow_cycle = level + 1;
+                }
+            } else if (last_use[nx][ny] < UT && flow_component[next] == component) {
+                last_use[nx][ny] = UT;
+                flow_level[next] = level + 1;
+                flow_arc[next] = 0;
+                flow_queue.push_back(next);
+            }
+        });
+    }
+    return flow_cycle != 0;
+}
 
-template<typename PType, typename VType, typename VFType>
-tuple<typename CommonTypeFixed<VType, VFType>::type, bool, pair<int, int>> Fluid<PType, VType, VFType>::propagate_flow(int x, int y, typename CommonTypeFixed<VType, VFType>::type lim) {
-    (*last_use)[x][y] = UT - 1;
-    V_COMMON_TYPE ret = 0;
-    for (auto [dx, dy] : deltas) {
-        int nx = x + dx, ny = y + dy;
-        if ((*field)[nx][ny] != '#' && (*last_use)[nx][ny] < UT) {
-            auto cap = velocity.get(x, y, dx, dy);
-            auto flow = velocity_flow.get(x, y, dx, dy);
-            if (flow == cap) {
+template<typename PType, typename VType, typename VFType, typename Storage>
+void Fluid<PType, VType, VFType, Storage>::flow_blocking(int x, int y) {
+    // Path from the source in the level graph, one frame per cell; the
+    // edge a frame leaves by is its current direction in flow_arc.
+    constexpr uint32_t dead = numeric_limits<uint32_t>::max();
+    uint32_t source = x * cols() + y;
+    auto edge = [&](const flow_frame& f) {
+        size_t d = flow_arc[f.x * cols() + f.y];
+        V_COMMON_TYPE cap = flow_capacity(f.x, f.y, d);
+        return pair{d, cap - velocity_flow.get(f.x, f.y, d)};
+    };
+    flow_stack.push({x, y, 0, 0, 0, false});
+    while (!flow_stack.empty()) {
+        auto& f = flow_stack.top();
+        uint32_t cell = f.x * cols() + f.y;
+        uint32_t level = flow_level[cell];
+        bool closed = false, pushed = false;
+        for (auto& d = flow_arc[cell]; d < deltas.size(); ++d) {
+            if (!topology.is_open(f.x, f.y, d) || !(velocity_flow.get(f.x, f.y, d) < flow_capacity(f.x, f.y, d))) {
                 continue;
             }
-            // assert(v >= velocity_flow.get(x, y, dx, dy));
-            auto vp = min(lim, cap - flow);
-            if ((*last_use)[nx][ny] == UT - 1) {
-                velocity_flow.add(x, y, dx, dy, vp);
-                (*last_use)[x][y] = UT;
-                // cerr << x << " " << y << " -> " << nx << " " << ny << " " << vp << " / " << lim << "\n";
-                return {vp, 1, {nx, ny}};
+            auto [dx, dy] = deltas[d];
+            int nx = f.x + dx, ny = f.y + dy;
+            uint32_t next = nx * cols() + ny;
+            if (next == source) {
+                if (level + 1 == flow_cycle) {
+                    closed = true;
+                    break;
+                }
+            } else if (last_use[nx][ny] == UT && flow_level[next] == level + 1 && level + 1 < flow_cycle) {
+                flow_stack.push({nx, ny, 0, 0, 0, false});
+                pushed = true;
+                break;
             }
-            auto [t, prop, end] = propagate_flow(nx, ny, vp);
-            ret += t;
-            if (prop) {
-                velocity_flow.add(x, y, dx, dy, t);
-                (*last_use)[x][y] = UT;
-                // cerr << x << " " << y << " -> " << nx << " " << ny << " " << t << " / " << lim << "\n";
-                return {t, prop && end != make_pair(x, y), end};
+        }
+        if (pushed) {
+            continue;
+        }
+        if (!closed) {
+            flow_level[cell] = dead;
+            flow_stack.pop();
+            continue;
+        }
+        // Augments by the bottleneck and saturates it exactly, then
+        // retreats to the first saturated edge.
+        V_COMMON_TYPE amount = edge(flow_stack[0]).second;
+        for (size_t i = 1; i < flow_stack.size(); ++i) {
+            amount = min(amount, edge(flow_stack[i]).second);
+        }
+        size_t keep = flow_stack.size();
+        for (size_t i = 0; i < flow_stack.size(); ++i) {
+            auto& g = flow_stack[i];
+            auto [d, residual] = edge(g);
+            auto& flow = velocity_flow.get(g.x, g.y, d);
+            auto cap = flow_capacity(g.x, g.y, d);
+            if (residual == amount) {
+                flow = cap;
+                keep = min(keep, i + 1);
+            } else {
+                flow = min(VFType(flow + amount), cap);
             }
         }
+        while (flow_stack.size() > keep) {
+            flow_stack.pop();
+        }
+    }
+}
+
+template<typename PType, typename VType, typename VFType, typename Storage>
+VFType Fluid<PType, VType, VFType, Storage>::flow_capacity(int x, int y, size_t d) {
+    auto cap = velocity.get(x, y, d);
+    VFType ans = VFType(cap);
+    if constexpr (is_floating_point_v<VFType>) {
+        // A double capacity converted to float may round up.
+        while (!(ans <= cap)) {
+            ans = nextafter(ans, VFType(0));
+        }
     }
-    (*last_use)[x][y] = UT;
-    return {ret, 0, {0, 0}};
+    return ans;
 }
 
+template<typename PType, typename VType, typename VFType, typename Storage>
+void Fluid<PType, VType, VFType, Storage>::recalculate_p() {
+    // Every moving cell first records the pressure it hands to each
+    // neighbour (or to itself, next to a wall). Each cell then adds up what
+    // it received in the order of the serial row-major sweep, so the result
+    // does not depend on the number of threads.
+    pool.parallel_for(moving.size(), grain, [&](size_t, size_t lo, size_t hi) {
+        for (size_t i = lo; i < hi; ++i) {
+            auto [x, y] = cell_xy(moving[i]);
+            uint8_t open = topology.open[x][y];
+            uint8_t mask = 0;
+            for_each_dir([&](auto d) {
+                constexpr auto dx = deltas[d].first, dy = deltas[d].second;
+                auto old_v = velocity.template get<d>(x, y);
+                auto new_v = velocity_flow.template get<d>(x, y);
+                if (old_v > 0) {
+                    assert(new_v <= old_v);
+                    velocity.template get<d>(x, y) = new_v;
+                    auto force = (old_v - new_v) * topology.rho[x][y];
+                    if (field[x][y] == '.')
+                        force *= 0.8;
+                    if (!((open >> d) & 1)) {
+                        kinetic_delta.template get<d>(x, y) = force / topology.dirs[x][y];
+                    } else {
+                        kinetic_delta.template get<d>(x, y) = force / topology.dirs[x + dx][y + dy];
+                    }
+                    mask |= uint8_t(1) << d;
+                }
+                velocity_flow.template get<d>(x, y) = 0;
+            });
+            kinetic_mask[x][y] = mask;
+        }
+    });
+
+    constexpr size_t up = dir_index(-1, 0), down = dir_index(1, 0);
+    constexpr size_t left = dir_index(0, -1), right = dir_index(0, 1);
+    const auto& fluid = topology.fluid;
+    partial_delta_p.assign(ThreadPool::chunks(fluid.size(), grain), PType(0));
+    pool.parallel_for(fluid.size(), grain, [&](size_t k, size_t lo, size_t hi) {
+        PType delta_p_sum = 0;
+        for (size_t i = lo; i < hi; ++i) {
+            auto [x, y] = cell_xy(fluid[i]);
+            uint8_t open = topology.open[x][y];
+            auto gather = [&](size_t sx, size_t sy, size_t d) {
+                if ((kinetic_mask[sx][sy] >> d) & 1) {
+                    auto delta = kinetic_delta.get(sx, sy, d);
+                    p[x][y] += delta;
+                    delta_p_sum += delta;
+                }
+            };
+            gather(x - 1, y, down);
+            gather(x, y - 1, right);
+            for_each_dir([&](auto d) {
+                if (!((open >> d) & 1))
+                    gather(x, y, d);
+            });
+            gather(x, y + 1, left);
+            gather(x + 1, y, up);
+        }
+        partial_delta_p[k] = delta_p_sum;
+    });
+    for (auto delta_p_sum : partial_delta_p) {
+        total_delta_p += delta_p_sum;
+    }
 
-template<typename PType, typename VType, typename VFType>
-void Fluid<PType, VType, VFType>::propagate_stop(int x, int y, bool force) {
-    if (!force) {
-        bool stop = true;
-        for (auto [dx, dy] : deltas) {
-            int nx = x + dx, ny = y + dy;
-            if ((*field)[nx][ny] != '#' && (*last_use)[nx][ny] < UT - 1 && velocity.get(x, y, dx, dy) > 0) {
-                stop = false;
+    pool.parallel_for(moving.size(), grain, [&](size_t, size_t lo, size_t hi) {
+        for (size_t i = lo; i < hi; ++i) {
+            auto [x, y] = cell_xy(moving[i]);
+            kinetic_mask[x][y] = 0;
+        }
+    });
+}
+
+template<typename PType, typename VType, typename VFType, typename Storage>
+template<typename T>
+T Fluid<PType, VType, VFType, Storage>::random01(int x, int y, uint8_t draw) {
+    if (rng_mode == RngMode::Mt19937) {
+        return Rnd::random01<T>();
+    }
+    // A cell draws at most once per direction after its first draw.
+    assert(draw <= deltas.size());
+    uint64_t counter = (uint64_t(x) * cols() + y) * (deltas.size() + 1) + draw;
+    return Rnd::from_bits<T>(Rnd::bits(tick_key, counter));
+}
+
+template<typename PType, typename VType, typename VFType, typename Storage>
+bool Fluid<PType, VType, VFType, Storage>::move_particles() {
+    counters.moved = 0;
+    const auto& fluid = topology.fluid;
+    if (rng_mode == RngMode::Counter) {
+        // Draw 0 of every cell, independent of which cells end up using it.
+        constexpr uint64_t stride = deltas.size() + 1;
+        pool.parallel_for(fluid.size(), grain, [&](size_t, size_t lo, size_t hi) {
+            for (size_t i = lo; i < hi; ++i) {
+                move_draws[i] = Rnd::from_bits<double>(Rnd::bits(tick_key, fluid[i] * stride));
+            }
+        });
+    }
+
+    UT = next_generation(UT, [&] {last_use.reset();});
+    bool prop = false;
+    for (size_t i = 0; i < fluid.size(); ++i) {
+        auto [x, y] = cell_xy(fluid[i]);
+        if (last_use[x][y] != UT) {
+            double draw = rng_mode == RngMode::Counter ? move_draws[i] : Rnd::random01<double>();
+            if (draw < move_prob(x, y)) {
+                prop = true;
+                propagate_move(x, y, true);
+            } else {
+                propagate_stop(x, y, true);
+            }
+        }
+    }
+    return prop;
+}
+
+template<typename PType, typename VType, typename VFType, typename Storage>
+template<bool Bounded>
+typename CommonTypeFixed<VType, VFType>::type Fluid<PType, VType, VFType, Storage>::propagate_flow(
+    int x, int y, typename CommonTypeFixed<VType, VFType>::type lim,
+    int UT, FrameStack<flow_frame>& flow_stack, const flow_tile& tile
+) {
+    // Result of the innermost finished frame, consumed by its parent.
+    V_COMMON_TYPE t = 0;
+    bool prop = false;
+    pair<int, int> end{0, 0};
+    bool returned = false;
+    // Whether that frame was stamped `settled`.
+    bool dead = false;
+
+    last_use[x][y] = UT - 1;
+    flow_stack.push({x, y, 0, lim, 0, false});
+    while (!flow_stack.empty()) {
+        auto& f = flow_stack.top();
+        if (returned) {
+            returned = false;
+            f.ret += t;
+            f.blocked |= !dead;
+            if (prop) {
+                velocity_flow.add(f.x, f.y, f.d, t);
+                last_use[f.x][f.y] = UT;
+                prop = end != make_pair(f.x, f.y);
+                returned = true;
+                dead = false;
+                flow_stack.pop();
+                continue;
+            }
+            ++f.d;
+        }
+        for (; f.d < deltas.size(); ++f.d) {
+            if (!topology.is_open(f.x, f.y, f.d)) {
+                continue;
+            }
+            auto [dx, dy] = deltas[f.d];
+            int nx = f.x + dx, ny = f.y + dy;
+            auto cap = velocity.get(f.x, f.y, f.d);
+            auto flow = velocity_flow.get(f.x, f.y, f.d);
+            if constexpr (Bounded) {
+                if (nx < tile.x0 || nx >= tile.x1 || ny < tile.y0 || ny >= tile.y1) {
+                    f.blocked |= flow != cap;
+                    continue;
+                }
+            }
+            stamp_t stamp = last_use[nx][ny];
+            if (stamp == settled || flow == cap) {
+                continue;
+            }
+            if (stamp >= UT) {
+                f.blocked = true;
+                continue;
+            }
+            // assert(v >= velocity_flow.get(x, y, d));
+            auto vp = min(f.lim, cap - flow);
+            if (stamp == UT - 1) {
+                velocity_flow.add(f.x, f.y, f.d, vp);
+                last_use[f.x][f.y] = UT;
+                // cerr << x << " " << y << " -> " << nx << " " << ny << " " << vp << " / " << lim << "\n";
+                t = vp, prop = true, end = {nx, ny};
+                returned = true;
+                dead = false;
                 break;
             }
+            last_use[nx][ny] = UT - 1;
+            flow_stack.push({nx, ny, 0, vp, 0, false});
+            break;
         }
-        if (!stop) {
-            return;
+        if (returned) {
+            flow_stack.pop();
+        } else if (f.d == deltas.size()) {
+            // Every residual edge leads to a settled cell, so no cycle can
+            // be reached from here for the rest of the phase.
+            dead = !f.blocked;
+            last_use[f.x][f.y] = dead ? settled : stamp_t(UT);
+            t = f.ret, prop = false, end = {0, 0};
+            returned = true;
+            flow_stack.pop();
         }
     }
-    (*last_use)[x][y] = UT;
-    for (auto [dx, dy] : deltas) {
+    return t;
+}
+
+template<typename PType, typename VType, typename VFType, typename Storage>
+bool Fluid<PType, VType, VFType, Storage>::can_stop(int x, int y) {
+    for (size_t d = 0; d < deltas.size(); ++d) {
+        auto [dx, dy] = deltas[d];
         int nx = x + dx, ny = y + dy;
-        if ((*field)[nx][ny] == '#' || (*last_use)[nx][ny] == UT || velocity.get(x, y, dx, dy) > 0) {
+        if (topology.is_open(x, y, d) && last_use[nx][ny] < UT - 1 && velocity.get(x, y, d) > 0) {
+            return false;
+        }
+    }
+    return true;
+}
+
+template<typename PType, typename VType, typename VFType, typename Storage>
+void Fluid<PType, VType, VFType, Storage>::propagate_stop(int x, int y, bool force) {
+    if (!force && !can_stop(x, y)) {
+        return;
+    }
+    last_use[x][y] = UT;
+    stop_stack.push({x, y, 0});
+    while (!stop_stack.empty()) {
+        auto& f = stop_stack.top();
+        if (f.d == deltas.size()) {
+            stop_stack.pop();
+            continue;
+        }
+        size_t d = f.d++;
+        auto [dx, dy] = deltas[d];
+        int nx = f.x + dx, ny = f.y + dy;
+        if (!topology.is_open(f.x, f.y, d) || last_use[nx][ny] == UT || velocity.get(f.x, f.y, d) > 0) {
             continue;
         }
-        propagate_stop(nx, ny);
+        if (can_stop(nx, ny)) {
+            last_use[nx][ny] = UT;
+            stop_stack.push({nx, ny, 0});
+        }
     }
 }
 
-template<typename PType, typename VType, typename VFType>
-VType Fluid<PType, VType, VFType>::move_prob(int x, int y) {
+template<typename PType, typename VType, typename VFType, typename Storage>
+VType Fluid<PType, VType, VFType, Storage>::move_prob(int x, int y) {
     VType sum = 0;
     for (size_t i = 0; i < deltas.size(); ++i) {
         auto [dx, dy] = deltas[i];
         int nx = x + dx, ny = y + dy;
-        if ((*field)[nx][ny] == '#' || (*last_use)[nx][ny] == UT) {
+        if (!topology.is_open(x, y, i) || last_use[nx][ny] == UT) {
             continue;
         }
-        auto v = velocity.get(x, y, dx, dy);
+        auto v = velocity.get(x, y, i);
         if (v < 0) {
             continue;
         }
@@ -534,132 +1745,135 @@ VType Fluid<PType, VType, VFType>::move_prob(int x, int y) {
     return sum;
 }
 
-template<typename PType, typename VType, typename VFType>
-bool Fluid<PType, VType, VFType>::propagate_move(int x, int y, bool is_first) {
-    (*last_use)[x][y] = UT - is_first;
+template<typename PType, typename VType, typename VFType, typename Storage>
+bool Fluid<PType, VType, VFType, Storage>::propagate_move(int x, int y, bool is_first) {
+    // Result of the innermost finished frame, consumed by its parent.
     bool ret = false;
-    int nx = -1, ny = -1;
-    do {
-        array<VType, deltas.size()> tres;
-        VType sum = 0;
-        for (size_t i = 0; i < deltas.size(); ++i) {
-            auto [dx, dy] = deltas[i];
-            int nx = x + dx, ny = y + dy;
-            if ((*field)[nx][ny] == '#' || (*last_use)[nx][ny] == UT) {
+    bool returned = false;
+
+    last_use[x][y] = UT - is_first;
+    move_stack.push({x, y, -1, -1, is_first, 1});
+    while (!move_stack.empty()) {
+        auto& f = move_stack.top();
+        bool done = false;
+        if (returned) {
+            returned = false;
+            done = ret;
+        }
+        while (!done) {
+            array<VType, deltas.size()> tres;
+            VType sum = 0;
+            for (size_t i = 0; i < deltas.size(); ++i) {
+                auto [dx, dy] = deltas[i];
+                int nx = f.x + dx, ny = f.y + dy;
+                if (!topology.is_open(f.x, f.y, i) || last_use[nx][ny] == UT) {
+                    tres[i] = sum;
+                    continue;
+                }
+                auto v = velocity.get(f.x, f.y, i);
+                if (v < 0) {
+                    tres[i] = sum;
+                    continue;
+                }
+                sum += v;
                 tres[i] = sum;
-                continue;
             }
-            auto v = velocity.get(x, y, dx, dy);
-            if (v < 0) {
-                tres[i] = sum;
-                continue;
+
+            if (sum == 0) {
+                ret = false;
+                break;
             }
-            sum += v;
-            tres[i] = sum;
-        }
 
-        if (sum == 0) {
-            break;
-        }
+            VType p = random01<VType>(f.x, f.y, f.draws++) * sum;
+            size_t d = ranges::upper_bound(tres, p) - tres.begin();
 
-        VType p = Rnd::random01<VType>() * sum;
-        size_t d = ranges::upper_bound(tres, p) - tres.begin();
+            auto [dx, dy] = deltas[d];
+            f.nx = f.x + dx;
+            f.ny = f.y + dy;
+            assert(velocity.get(f.x, f.y, d) > 0 && topology.is_open(f.x, f.y, d) && last_use[f.nx][f.ny] < UT);
 
-        auto [dx, dy] = deltas[d];
-        nx = x + dx;
-        ny = y + dy;
-        assert(velocity.get(x, y, dx, dy) > 0 && (*field)[nx][ny] != '#' && (*last_use)[nx][ny] < UT);
+            if (last_use[f.nx][f.ny] == UT - 1) {
+                ret = true;
+                break;
+            }
+            last_use[f.nx][f.ny] = UT;
+            move_stack.push({f.nx, f.ny, -1, -1, false, 1});
+            break;
+        }
+        if (&move_stack.top() != &f) {
+            continue;
+        }
 
-        ret = ((*last_use)[nx][ny] == UT - 1 || propagate_move(nx, ny, false));
-    } while (!ret);
-    (*last_use)[x][y] = UT;
-    for (size_t i = 0; i < deltas.size(); ++i) {
-        auto [dx, dy] = deltas[i];
-        int nx = x + dx, ny = y + dy;
-        if ((*field)[nx][ny] != '#' && (*last_use)[nx][ny] < UT - 1 && velocity.get(x, y, dx, dy) < 0) {
-            propagate_stop(nx, ny);
+        last_use[f.x][f.y] = UT;
+        for (size_t i = 0; i < deltas.size(); ++i) {
+            auto [dx, dy] = deltas[i];
+            int nx = f.x + dx, ny = f.y + dy;
+            if (topology.is_open(f.x, f.y, i) && last_use[nx][ny] < UT - 1 && velocity.get(f.x, f.y, i) < 0) {
+                propagate_stop(nx, ny);
+            }
         }
-    }
-    if (ret) {
-        if (!is_first) {
-            ParticleParams<PType, VType> pp{};
-            pp.swap_with(*this, x, y);
-            pp.swap_with(*this, nx, ny);
-            pp.swap_with(*this, x, y);
+        if (ret) {
+            if (!f.is_first) {
+                ++counters.moved;
+                ParticleParams<PType, VType> pp{};
+                pp.swap_with(*this, f.x, f.y);
+                pp.swap_with(*this, f.nx, f.ny);
+                pp.swap_with(*this, f.x, f.y);
+            }
         }
+        returned = true;
+        move_stack.pop();
     }
     return ret;
 }
 
-template<typename PType, typename VType, typename VFType>
-void Fluid<PType, VType, VFType>::read_RHO(ifstream &fin){
-    stringstream ss;
-    string line;
-    
-    while (read_line(fin, line)) {
-        if (line.find_first_not_of(' ') == string::npos || line.empty()) {
+template<typename PType, typename VType, typename VFType, typename Storage>
+void Fluid<PType, VType, VFType, Storage>::read_RHO(TextFile& fin){
+    string_view line;
+    while (fin.next(line)) {
+        if (line.find_first_not_of(' ') == string_view::npos) {
             break;
         }
 
-        ss = stringstream{line};
-        char c = ss.get();
-        if (!(ss >> rho[c])) {
+        TextRow row(line.substr(1));
+        if (!row.get(rho[uint8_t(line[0])])) {
             throw runtime_error("Не удалось прочитать параметр RHO");
         }
     }
 }
 
-template<typename PType, typename VType, typename VFType>
-void Fluid<PType, VType, VFType>::read_G(ifstream &fin){
-    stringstream ss;
-    string line;
-    
-    if (!read_line(fin, line)) {
-        throw runtime_error("Не удалось прочитать параметр G");
-    }
-    ss = stringstream{line};
-    if (!(ss >> g)) {
+template<typename PType, typename VType, typename VFType, typename Storage>
+void Fluid<PType, VType, VFType, Storage>::read_G(TextFile& fin){
+    string_view line;
+    if (!fin.next(line) || !TextRow(line).get(g)) {
         throw runtime_error("Не удалось прочитать параметр G");
     }
 }
 
 
 
-template<typename PType, typename VType, typename VFType>
-void Fluid<PType, VType, VFType>::read_field(ifstream &fin){
-    string line;
+template<typename PType, typename VType, typename VFType, typename Storage>
+void Fluid<PType, VType, VFType, Storage>::read_field(TextFile& fin){
+    const string_view* rows = fin.take(n);
+    if (!rows) {
+        throw runtime_error("Не удалось прочитать параметр Field");
+    }
     for (size_t i = 0; i < n; ++i) {
-        if (!read_line(fin, line)) {
-            throw runtime_error("Не удалось прочитать параметр Field");
-        }
-        if (line.size() != m) {
+        if (rows[i].size() != m) {
             throw runtime_error("Неверно указаны размеры поля");
         }
-        for (size_t j = 0; j < m; ++j) {
-            (*field)[i][j] = line[j];
-        }
+        memcpy(field[i], rows[i].data(), m);
     }
 }
 
-template<typename PType, typename VType, typename VFType>
-void Fluid<PType, VType, VFType>::read_NM(ifstream &fin){
-    stringstream ss;
-    string line;
-
-    if (!read_line(fin, line)) {
+template<typename PType, typename VType, typename VFType, typename Storage>
+void Fluid<PType, VType, VFType, Storage>::read_NM(TextFile& fin){
+    string_view line;
+    if (!fin.next(line)) {
         throw runtime_error("Не удалось прочитать");
     }
-    ss = stringstream{line};
-    if (!(ss >> n) || !(ss >> m)) {
+    TextRow row(line);
+    if (!row.get(n) || !row.get(m)) {
         throw runtime_error("Не удалось прочитать параметры N и M");
     }
 }
-
-template<typename PType, typename VType, typename VFType>
-bool Fluid<PType, VType, VFType>::read_line(ifstream& fin, string& line){
-    while (true) {
-        if (!getline(fin, line))    {return false;}
-        if (line.starts_with("//")) {continue;}
-        return true;
-    }
-}
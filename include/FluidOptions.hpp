@@ -0,0 +1,98 @@
+#pragma once
+
+#include "argv_parse.hpp"
+#include "Const.hpp"
+#include "Output.hpp"
+
+#include <cstddef>
+#include <cstdint>
+#include <string>
+
+using namespace std;
+
+enum class SaveFormat {
+    // Human-readable export, the format of the .in/.out files.
+    Text,
+    // Versioned snapshot with the values in their native representation.
+    Binary,
+};
+
+enum class FlowMode {
+    // One sequential augmenting-path sweep over the grid.
+    Serial,
+    // Paths inside tiles first, in parallel, then the sequential sweep.
+    Tiled,
+};
+
+enum class FlowSolver {
+    // Depth-first augmenting paths from every cell, repeated until a sweep
+    // finds none.
+    Dfs,
+    // Blocking flows on BFS level graphs, with every cell in turn as both
+    // source and sink.
+    Dinic,
+};
+
+/// Runtime settings of a simulation run, collected from the command line.
+struct FluidOptions {
+    string  filename;
+    bool    need_save = false;
+    string  save_filename;
+    SaveFormat save_format = SaveFormat::Binary;
+    // Save every K ticks in addition to SIGINT/SIGTERM; 0 disables.
+    size_t  checkpoint_every = 0;
+
+    // Worker threads for the force, pressure and kinetic phases.
+    size_t  threads = 1;
+
+    FlowMode flow_mode = FlowMode::Serial;
+    // Side of a square tile in the tiled flow mode.
+    size_t  flow_tile = 32;
+    FlowSolver flow_solver = FlowSolver::Dfs;
+
+    OutputMode output = OutputMode::Text;
+    // Render at most every K ticks; a frame is due only if something moved.
+    size_t  render_every = 1;
+    bool    has_roi = false;
+    Roi     roi{};
+    // Frames buffered for the writer thread; 0 writes them inline.
+    size_t  output_queue = 8;
+    OutputPolicy output_policy = OutputPolicy::Block;
+
+    // Recording of the run; empty disables.
+    string  record_filename;
+    size_t  record_keyframe = 100;
+    // Keyframes with p and velocity, not only the field.
+    bool    record_full = false;
+
+    // Stop criteria; 0 disables each of them. Without max_ticks the run
+    // ends at tick 1'000'000.
+    size_t  max_ticks = 0;
+    // Wall-clock budget in seconds.
+    double  time_limit = 0;
+    // Stop after this many consecutive ticks in which no particle moved and
+    // no p or velocity value changed by more than steady_tol.
+    size_t  steady_ticks = 0;
+    double  steady_tol = 1e-4;
+
+    // Skip the force and pressure phases in square tiles whose p and
+    // velocity changed by at most dirty_tol, as did their neighbours.
+    // Approximate unless dirty_tol is 0.
+    bool    dirty_tiles = false;
+    size_t  dirty_tile = 16;
+    double  dirty_tol = 1e-4;
+    // Run every tick both with and without skipping and report the
+    // difference.
+    bool    verify_tiles = false;
+
+    // Chrome trace of phase times and counters; empty disables.
+    string  profile_filename;
+
+    // Named pipe for commands to the running simulation; empty disables.
+    string  control_path;
+
+    RngMode rng = RngMode::Counter;
+    uint64_t seed = 1337;
+};
+
+FluidOptions parseFluidOptions(ArgvParseResult& opts);
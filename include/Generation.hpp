@@ -0,0 +1,34 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <limits>
+
+using namespace std;
+
+/// Per-cell stamps of the depth-first traversals in Fluid.
+///
+/// A sweep with generation UT marks the cells it has finished with UT and
+/// the cells on its stack with UT - 1; everything written by earlier sweeps
+/// only has to compare below UT - 1. So once the counter nears the top of
+/// stamp_t, all stamps can be reset to 0 and counting restarts from 0
+/// without changing a single comparison. Rebasing happens at a sweep
+/// boundary, once every 32k sweeps, and the counter can never overflow.
+using stamp_t = uint16_t;
+
+/// Stamp above every generation. The flow phase marks cells with it that
+/// its searches need not enter again for the rest of the phase (see
+/// make_flow and make_flow_dinic) and replaces it before the next
+/// traversal runs.
+constexpr stamp_t settled = numeric_limits<stamp_t>::max();
+
+/// Generation of the sweep after `generation`; `rebase` resets the stamps
+/// the sweep can see to 0 when the counter has to restart.
+template<typename Rebase>
+int next_generation(int generation, Rebase&& rebase) {
+    if (generation > int(settled) - 3) {
+        rebase();
+        generation = 0;
+    }
+    return generation + 2;
+}
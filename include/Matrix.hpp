@@ -1,125 +1,132 @@
 #pragma once
 
+#include <algorithm>
 #include <cassert>
 #include <cstddef>
-#include <iostream>
 #include <memory>
+#include <utility>
+
+/// StaticMatrix<T, N, M>
+/// Row-major N x M matrix with compile-time bounds. Indexing is plain
+/// pointer arithmetic with a constexpr stride, so it inlines and vectorizes.
+template<typename T, size_t N, size_t M>
+class StaticMatrix {
+    private:
+        std::unique_ptr<T[]> owned_;
+        T* data_ = nullptr;
 
-template<typename T>
-class AbstractMatrix {
     public:
-        AbstractMatrix& operator=(const AbstractMatrix& other);
+        StaticMatrix() = default;
 
-        virtual ~AbstractMatrix() = default;
+        StaticMatrix(size_t n, size_t m) : owned_(new T[N * M]{}), data_(owned_.get()) {
+            assert(n == N && m == M);
+        }
 
-        virtual size_t get_n() const = 0;
+        // View of zeroed storage owned by someone else, e.g. an Arena.
+        StaticMatrix(size_t n, size_t m, T* storage) : data_(storage) {
+            assert(n == N && m == M);
+        }
 
-        virtual size_t get_m() const = 0;
+        static constexpr size_t get_n() {return N;}
 
-        void reset();
+        static constexpr size_t get_m() {return M;}
 
-        virtual T* operator[](size_t i) = 0;
-        virtual T* operator[](size_t i) const = 0;
-};
+        static constexpr size_t size() {return N * M;}
 
-template<typename T, size_t N, size_t M>
-class StaticMatix : public AbstractMatrix<T> {
-    private:
-        std::unique_ptr<T[]> data;
+        T* operator[](size_t i) {return data_ + i * M;}
 
-    public:
-        StaticMatix(size_t n, size_t m) : data(new T[N * M]{}){
-            assert(n == N && m == M);
-        }
+        const T* operator[](size_t i) const {return data_ + i * M;}
 
-        size_t get_n() const override {return N;}
+        T* data() {return data_;}
 
-        size_t get_m() const override {return M;}
+        const T* data() const {return data_;}
 
-        T* operator[](size_t i) override {return (T*)data.get() + i * M;}
+        void reset() {std::fill_n(data_, N * M, T{});}
 
-        T* operator[](size_t i) const override {return (T*)data.get() + i * M;}
+        void swap(StaticMatrix& other) noexcept {
+            owned_.swap(other.owned_);
+            std::swap(data_, other.data_);
+        }
 };
 
+/// DynamicMatrix<T>
+/// Row-major matrix with bounds known only at runtime. Used for grids
+/// whose size is not listed in SIZES.
 template<typename T>
-class DynamicMatrix : public AbstractMatrix<T> {
+class DynamicMatrix {
     private:
-        size_t N, M;;
-        std::unique_ptr<T[]> data;
-    
+        size_t N = 0, M = 0;
+        std::unique_ptr<T[]> owned_;
+        T* data_ = nullptr;
+
     public:
+        DynamicMatrix() = default;
+
         DynamicMatrix(size_t N, size_t M)
-          : data(new T[N * M]{}),
-            N(N),
-            M(M)
+          : N(N),
+            M(M),
+            owned_(new T[N * M]{}),
+            data_(owned_.get())
         {}
 
-        T* operator[](size_t i) override {
-            return (T*)data.get() + i * M;
-        }
+        // View of zeroed storage owned by someone else, e.g. an Arena.
+        DynamicMatrix(size_t N, size_t M, T* storage)
+          : N(N),
+            M(M),
+            data_(storage)
+        {}
 
-        T* operator[](size_t i) const override {
-            return (T*)data.get() + i * M;
-        }
+        size_t get_n() const {return N;}
 
-        size_t get_n() const override {return N;}
+        size_t get_m() const {return M;}
 
-        size_t get_m() const override {return M;}
-};
+        size_t size() const {return N * M;}
 
-struct size_marker {
-    size_t n;
-    size_t m;
-};
+        T* operator[](size_t i) {return data_ + i * M;}
 
-template<typename T, size_marker... SZS>
-class create_matrix_;
+        const T* operator[](size_t i) const {return data_ + i * M;}
 
-template<typename T, size_marker SZ, size_marker... SZS>
-class create_matrix_<T, SZ, SZS...> {
-public:
-    AbstractMatrix<T>* operator()(size_t n, size_t m) {
-        constexpr auto N = SZ.n;
-        constexpr auto M = SZ.m;
+        T* data() {return data_;}
 
-        if (N == n && M == m) {
-            return new StaticMatix<T, N, M>(N, M);
-        }
+        const T* data() const {return data_;}
 
-        return create_matrix_<T, SZS...>{}(n, m);
-    }
-};
+        void reset() {std::fill_n(data_, N * M, T{});}
 
-template<typename T>
-class create_matrix_<T> {
-public:
-    AbstractMatrix<T>* operator()(size_t n, size_t m) {
-        return new DynamicMatrix<T>(n, m);
-    }
+        void swap(DynamicMatrix& other) noexcept {
+            std::swap(N, other.N);
+            std::swap(M, other.M);
+            owned_.swap(other.owned_);
+            std::swap(data_, other.data_);
+        }
 };
 
-#define S(n, m) size_marker(n, m)
+template<typename T, size_t N, size_t M>
+void swap(StaticMatrix<T, N, M>& a, StaticMatrix<T, N, M>& b) noexcept {a.swap(b);}
 
 template<typename T>
-struct create_matrix : public create_matrix_<T, SIZES> {};
+void swap(DynamicMatrix<T>& a, DynamicMatrix<T>& b) noexcept {a.swap(b);}
 
+/// Storage policies
+/// Select the matrix implementation used by Fluid. `PAD` extra columns are
+/// appended to every row (the field keeps one for a trailing '\0').
+template<size_t N, size_t M>
+struct StaticStorage {
+    static constexpr bool is_static = true;
 
-template<typename T>
-AbstractMatrix<T>& AbstractMatrix<T>::operator=(const AbstractMatrix<T>& other) {
-    assert(get_n() == other.get_n() && get_m() == other.get_m());
-    for (size_t i = 0; i < get_n(); ++i) {
-        for (size_t j = 0; j < get_m(); ++j) {
-            (*this)[i][j] = other[i][j];
-        }
-    }
-    return *this;
-}
+    template<typename T, size_t PAD = 0>
+    using matrix = StaticMatrix<T, N, M + PAD>;
+};
 
-template<typename T>
-void AbstractMatrix<T>::reset() {
-    for (size_t i = 0; i < get_n(); ++i) {
-        for (size_t j = 0; j < get_m(); ++j) {
-            (*this)[i][j] = T{};
-        }
-    }
-}
\ No newline at end of file
+struct DynamicStorage {
+    static constexpr bool is_static = false;
+
+    template<typename T, size_t PAD = 0>
+    using matrix = DynamicMatrix<T>;
+};
+
+struct size_marker {
+    size_t n;
+    size_t m;
+};
+
+#define S(n, m) size_marker(n, m)
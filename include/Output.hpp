@@ -0,0 +1,58 @@
+#pragma once
+
+#include <chrono>
+#include <cstddef>
+#include <memory>
+#include <string>
+
+using namespace std;
+
+enum class OutputMode {
+    // No frames; a throughput summary when the run ends.
+    None,
+    // "Tick i:" followed by the field rows, the historical format.
+    Text,
+    // Per frame: uint64 tick, uint32 rows, uint32 cols, then the rows
+    // without separators.
+    Binary,
+};
+
+/// What a full frame queue does with a new frame.
+enum class OutputPolicy {
+    // Wait for the writer.
+    Block,
+    // Skip the frame and count it.
+    Drop,
+};
+
+/// Window [x0, x1) x [y0, y1) of the field that is rendered.
+struct Roi {
+    size_t x0, y0, x1, y1;
+};
+
+/// Field rows as stored by Fluid: `rows` rows of `cols` chars each, `stride`
+/// chars apart.
+struct FieldView {
+    const char* data;
+    size_t      stride;
+    size_t      rows, cols;
+};
+
+/// OutputSink
+/// Output stage of the simulation. Frames are formatted into a reused
+/// buffer and written to stdout with one write and one flush each.
+class OutputSink {
+public:
+    virtual ~OutputSink() = default;
+
+    virtual void frame(size_t tick, const FieldView& field) = 0;
+
+    /// Called once when the run ends.
+    virtual void finish(size_t ticks, size_t cells, chrono::duration<double> elapsed) {}
+};
+
+/// Sink for `mode`; `roi` may be null for the whole field. With a nonzero
+/// `queue`, frames are copied into a ring of that many preallocated
+/// buffers and formatted and written by a writer thread.
+unique_ptr<OutputSink> make_output_sink(OutputMode mode, const Roi* roi, size_t queue = 0,
+                                        OutputPolicy policy = OutputPolicy::Block);
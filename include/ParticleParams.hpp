@@ -4,7 +4,7 @@
 using namespace std;
 
 
-template<typename PType, typename VType, typename VFType>
+template<typename PType, typename VType, typename VFType, typename Storage>
 class Fluid;
 
 template<typename PType, typename VType>
@@ -12,18 +12,23 @@ class ParticleParams {
 public:
     char type;
     PType cur_p;
+    PType cur_rho;
     array<VType, deltas.size()> v;
 
 public:
-    template<typename VFType>
-    void swap_with(Fluid<PType, VType, VFType>& f, int x, int y);
+    template<typename VFType, typename Storage>
+    void swap_with(Fluid<PType, VType, VFType, Storage>& f, int x, int y);
 };
 
 
 template<typename PType, typename VType>
-template<typename VFType>
-void ParticleParams<PType, VType>::swap_with(Fluid<PType, VType, VFType>& f, int x, int y) {
-    swap((*f.field)[x][y], type);
-    swap((*f.p)[x][y], cur_p);
-    swap((*f.velocity.v)[x][y], v);
+template<typename VFType, typename Storage>
+void ParticleParams<PType, VType>::swap_with(Fluid<PType, VType, VFType, Storage>& f, int x, int y) {
+    swap(f.field[x][y], type);
+    if (f.recorder) {
+        f.recorder->touch(x, y);
+    }
+    swap(f.p[x][y], cur_p);
+    swap(f.topology.rho[x][y], cur_rho);
+    f.velocity.swap_cell(x, y, v);
 }
\ No newline at end of file
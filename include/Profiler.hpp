@@ -0,0 +1,82 @@
+#pragma once
+
+#include <array>
+#include <chrono>
+#include <cstddef>
+#include <cstdint>
+#include <fstream>
+#include <string>
+
+using namespace std;
+
+enum class ProfilePhase : uint8_t {
+    ExternalForces,
+    PForces,
+    Flow,
+    RecalculateP,
+    Move,
+    Output,
+    Count,
+};
+
+/// Counters of one tick, collected by Fluid whether or not it is profiled.
+struct TickCounters {
+    // Iterations of the do/while loop of the flow phase.
+    size_t  flow_sweeps = 0;
+    // Frames pushed by the flow, stop and move traversals.
+    size_t  dfs_nodes = 0;
+    // Deepest stack of any traversal.
+    size_t  max_depth = 0;
+    // Particles swapped into a new cell by the move phase.
+    size_t  moved = 0;
+    double  total_delta_p = 0;
+};
+
+/// Profiler
+/// Streams per-tick phase times and counters as Chrome trace events
+/// (chrome://tracing, Perfetto) and writes a CSV summary next to the trace
+/// when the run ends. Fluid only calls it when --profile is given.
+class Profiler {
+public:
+    using clock = chrono::steady_clock;
+
+public:
+    explicit Profiler(const string& filename);
+    // Closes the trace and writes the summary.
+    ~Profiler();
+
+    Profiler(const Profiler&) = delete;
+    Profiler& operator=(const Profiler&) = delete;
+
+    void begin_tick(size_t tick);
+
+    void phase(ProfilePhase phase, clock::time_point start, clock::time_point end);
+
+    void end_tick(const TickCounters& counters);
+
+private:
+    struct Summary {
+        size_t  count = 0;
+        double  total = 0;
+        double  max = 0;
+
+        void add(double value);
+    };
+
+    double micros(clock::time_point t) const;
+
+    void event(const string& text);
+
+private:
+    string              csv_filename;
+    ofstream            trace;
+    bool                first_event = true;
+    clock::time_point   origin;
+
+    size_t              tick = 0;
+    clock::time_point   tick_start;
+
+    array<Summary, size_t(ProfilePhase::Count)> phases;
+    Summary             ticks;
+    Summary             flow_sweeps, dfs_nodes, max_depth, moved, total_delta_p;
+};
@@ -0,0 +1,121 @@
+#pragma once
+
+#include "Output.hpp"
+#include "Snapshot.hpp"
+
+#include <cstddef>
+#include <cstdint>
+#include <fstream>
+#include <initializer_list>
+#include <string>
+#include <utility>
+#include <vector>
+
+using namespace std;
+
+/// Recording file layout
+///
+///     RecordingHeader
+///     records...
+///     index: {uint64 tick, uint64 offset} per keyframe
+///     uint64 keyframe count, uint64 index offset, "FLUIDIDX"
+///
+/// A record starts with a uint8 kind and a uint64 tick. A keyframe holds
+/// the state at the start of its tick: uint64 size, then the field
+/// (n * m chars, row-major) and, with `full_keyframes`, p (p_tag) and the
+/// velocity planes (v_tag) as in a snapshot. A delta holds the cells whose
+/// particle changed during its tick: uint32 count, then uint32 cell index
+/// (x * m + y) and the new char per cell. Deltas are written for every tick
+/// in which a particle moved, so there is one per rendered text frame.
+struct RecordingHeader {
+    static constexpr char     magic_value[8] = {'F', 'L', 'U', 'I', 'D', 'R', 'E', 'C'};
+    static constexpr char     index_magic[8] = {'F', 'L', 'U', 'I', 'D', 'I', 'D', 'X'};
+    static constexpr uint32_t current_version = 1;
+
+    char        magic[8];
+    uint32_t    version;
+    uint32_t    header_size;
+    uint64_t    n, m;
+    uint64_t    keyframe_every;
+    uint64_t    start_tick;
+    uint32_t    full_keyframes;
+    SnapshotTag p_tag;
+    SnapshotTag v_tag;
+};
+
+enum RecordKind : uint8_t {
+    Keyframe    = 1,
+    Delta       = 2,
+};
+
+/// Recorder
+/// Writes a recording while the simulation runs. Particle swaps report the
+/// cells they touch; at the end of a tick only the cells whose char really
+/// changed are written, so the file grows with activity, not with area.
+class Recorder {
+public:
+    Recorder(const string& filename, RecordingHeader header);
+    // Writes the index; a recording without it cannot be read.
+    ~Recorder();
+
+    Recorder(const Recorder&) = delete;
+    Recorder& operator=(const Recorder&) = delete;
+
+    bool keyframe_due(size_t tick) const {
+        return (tick - header.start_tick) % header.keyframe_every == 0;
+    }
+
+    /// `extra` are the raw p and velocity arrays of a full keyframe.
+    void keyframe(size_t tick, const FieldView& field, initializer_list<pair<const void*, size_t>> extra = {});
+
+    void touch(size_t x, size_t y) {
+        uint32_t cell = x * header.m + y;
+        if (!touched_flags[cell]) {
+            touched_flags[cell] = 1;
+            touched.push_back(cell);
+        }
+    }
+
+    void end_tick(size_t tick, const FieldView& field, bool moved);
+
+private:
+    RecordingHeader         header;
+    ofstream                file;
+    vector<pair<uint64_t, uint64_t>> index;
+    // Field as of the last written record.
+    vector<char>            shadow;
+    vector<uint32_t>        touched;
+    vector<uint8_t>         touched_flags;
+    string                  buffer;
+};
+
+/// RecordingReader
+/// Reconstructs the field at any tick from the nearest keyframe before it,
+/// reading at most keyframe_every deltas.
+class RecordingReader {
+public:
+    RecordingHeader header;
+
+public:
+    explicit RecordingReader(const string& filename);
+
+    /// Field at the start of `tick`.
+    void seek(size_t tick);
+
+    /// Applies the next delta; the field then holds the state after `tick`.
+    bool next(size_t& tick);
+
+    /// Row-major, n * m chars.
+    const vector<char>& field() const {return cells;}
+
+private:
+    bool read_record_head(uint8_t& kind, uint64_t& tick);
+    void read_keyframe();
+    void read_delta();
+
+private:
+    ifstream                fin;
+    vector<pair<uint64_t, uint64_t>> index;
+    uint64_t                records_end = 0;
+    vector<char>            cells;
+};
@@ -6,6 +6,7 @@
 #include "type_marker.hpp"
 
 #include <cctype>
+#include <fstream>
 #include <sstream>
 #include <stdexcept>
 #include <string>
@@ -14,17 +15,47 @@
 using namespace std;
 
 struct Simulator {
-    string filename;
-    bool need_save;
-    string save_filename;
+    FluidOptions opts;
 
-    template<typename P_TYPE, typename V_TYPE, typename V_FLOW_TYPE>
+    template<typename P_TYPE, typename V_TYPE, typename V_FLOW_TYPE, typename STORAGE>
     void execute() {
-        Fluid<P_TYPE, V_TYPE, V_FLOW_TYPE> fluid(filename, need_save, save_filename);
+        Fluid<P_TYPE, V_TYPE, V_FLOW_TYPE, STORAGE> fluid(opts);
         fluid.run();
     }
 };
 
+// Reads N and M from the header of a snapshot or a .in/.out file, formatted as "N,M" for
+// matching against the size markers before the Fluid is constructed.
+inline string read_field_size(const string& filename) {
+    ifstream fin(filename);
+    if (!fin) {
+        throw runtime_error("Не удалось открыть файл");
+    }
+
+    if (is_snapshot_file(filename)) {
+        SnapshotHeader header = read_snapshot_header(filename);
+        stringstream ans;
+        ans << header.n << "," << header.m;
+        return ans.str();
+    }
+
+    string line;
+    size_t header_lines = 0;
+    size_t n, m;
+    while (getline(fin, line)) {
+        if (line.starts_with("//")) {continue;}
+        if (++header_lines < 2)     {continue;}
+
+        stringstream ss{line};
+        if (!(ss >> n) || !(ss >> m)) {break;}
+
+        stringstream ans;
+        ans << n << "," << m;
+        return ans.str();
+    }
+    throw runtime_error("Не удалось прочитать параметры N и M");
+}
+
 
 struct double_type_marker {
     using type = double;
@@ -64,7 +95,45 @@ struct fast_fixed_type_marker {
     }  
 };
 
+template<size_marker SZ>
+struct static_size_marker {
+    using type = StaticStorage<SZ.n, SZ.m>;
+
+    bool matches(string_view s) const {
+        stringstream ss;
+        ss << SZ.n << "," << SZ.m;
+        return to_lower_rm_space(s) == ss.str();
+    }
+};
+
+struct dynamic_size_marker {
+    using type = DynamicStorage;
+
+    bool matches(string_view s) const {
+        return true;
+    }
+};
+
+/// size_markers<SZS...>
+/// Static storage for every listed size followed by the dynamic fallback;
+/// `static_type` has the listed sizes only.
+template<size_marker... SZS>
+struct size_markers {
+    using type = type_list<static_size_marker<SZS>..., dynamic_size_marker>;
+    using static_type = type_list<static_size_marker<SZS>...>;
+};
+
 #define FLOAT float_type_marker
 #define DOUBLE double_type_marker
 #define FIXED(N, K) fixed_type_marker<N, K>
 #define FAST_FIXED(N, K) fast_fixed_type_marker<N, K>
+#define COMBO(...) type_list<__VA_ARGS__>
+
+/// type_combos
+/// (PType, VType, VFType) combinations to instantiate: the COMBOS list when
+/// given, every combination of TYPES otherwise.
+#ifdef COMBOS
+using type_combos = type_list<COMBOS>;
+#else
+using type_combos = product<type_list<TYPES>, type_list<TYPES>, type_list<TYPES>>::type;
+#endif
@@ -0,0 +1,231 @@
+#pragma once
+
+#include "FixedInner.hpp"
+
+#include <cstdint>
+#include <cstring>
+#include <fstream>
+#include <stdexcept>
+#include <string>
+#include <type_traits>
+#include <vector>
+
+using namespace std;
+
+/// SnapshotTag
+/// How a numeric type is stored in a binary snapshot. Fixed and FastFixed
+/// with the same raw width and fraction bits share one representation.
+struct SnapshotTag {
+    enum Kind : uint8_t {
+        Float       = 1,
+        Double      = 2,
+        FixedPoint  = 3,
+    };
+
+    uint8_t kind = 0;
+    // Bytes per stored value.
+    uint8_t size = 0;
+    // Fraction bits of a fixed-point value.
+    uint8_t frac = 0;
+    uint8_t reserved = 0;
+
+    bool operator==(const SnapshotTag&) const = default;
+};
+
+template<typename T>
+constexpr SnapshotTag snapshot_tag() {
+    if constexpr (IsFixedInner<T>::value) {
+        return {SnapshotTag::FixedPoint, uint8_t(sizeof(typename T::type)), uint8_t(T::k)};
+    } else if constexpr (is_same_v<T, float>) {
+        return {SnapshotTag::Float, uint8_t(sizeof(float)), 0};
+    } else {
+        static_assert(is_same_v<T, double>, "Тип не поддерживается снимком");
+        return {SnapshotTag::Double, uint8_t(sizeof(double)), 0};
+    }
+}
+
+/// SnapshotHeader
+/// Fixed-size header of a snapshot file. The payload that follows holds, in
+/// this order and without padding: g (v_tag), rho[256] (p_tag), the field
+/// (n * m chars), the velocity planes in `deltas` order (4 * n * m, v_tag),
+/// last_use (n * m uint16; int32 in version 1) and p (n * m, p_tag).
+struct SnapshotHeader {
+    static constexpr char     magic_value[8] = {'F', 'L', 'U', 'I', 'D', 'S', 'N', 'P'};
+    static constexpr uint32_t current_version = 2;
+
+    char        magic[8];
+    uint32_t    version;
+    uint32_t    header_size;
+    uint64_t    n, m;
+    uint64_t    tick;
+    int64_t     UT;
+    SnapshotTag p_tag;
+    SnapshotTag v_tag;
+    uint64_t    payload_size;
+    // FNV-1a over the payload, one 64-bit word per step.
+    uint64_t    checksum;
+};
+
+inline uint64_t snapshot_checksum(const char* data, size_t size) {
+    constexpr uint64_t prime = 0x100000001b3;
+    uint64_t hash = 0xcbf29ce484222325;
+    size_t i = 0;
+    for (; i + 8 <= size; i += 8) {
+        uint64_t word;
+        memcpy(&word, data + i, 8);
+        hash = (hash ^ word) * prime;
+    }
+    for (; i < size; ++i) {
+        hash = (hash ^ uint8_t(data[i])) * prime;
+    }
+    return hash;
+}
+
+inline bool is_snapshot_file(const string& filename) {
+    ifstream fin(filename, ios::binary);
+    char magic[sizeof(SnapshotHeader::magic_value)];
+    return fin.read(magic, sizeof(magic)) && memcmp(magic, SnapshotHeader::magic_value, sizeof(magic)) == 0;
+}
+
+// Only the header, to pick the storage before the snapshot is loaded.
+inline SnapshotHeader read_snapshot_header(const string& filename) {
+    ifstream fin(filename, ios::binary);
+    SnapshotHeader header;
+    if (!fin.read(reinterpret_cast<char*>(&header), sizeof(header))
+        || memcmp(header.magic, SnapshotHeader::magic_value, sizeof(header.magic)) != 0) {
+        throw runtime_error("Не удалось прочитать заголовок снимка");
+    }
+    return header;
+}
+
+/// SnapshotWriter
+/// Collects the payload in memory, then writes header and payload as two
+/// contiguous blocks. `clear` keeps the capacity, so a reused writer copies
+/// every array with a single memcpy.
+class SnapshotWriter {
+private:
+    vector<char> payload;
+
+public:
+    explicit SnapshotWriter(size_t reserve = 0) {payload.reserve(reserve);}
+
+    void clear() {payload.clear();}
+
+    template<typename T>
+    void put(const T* data, size_t count) {
+        static_assert(is_trivially_copyable_v<T>);
+        const char* bytes = reinterpret_cast<const char*>(data);
+        payload.insert(payload.end(), bytes, bytes + count * sizeof(T));
+    }
+
+    void write(const string& filename, SnapshotHeader header) const {
+        memcpy(header.magic, SnapshotHeader::magic_value, sizeof(header.magic));
+        header.version = SnapshotHeader::current_version;
+        header.header_size = sizeof(SnapshotHeader);
+        header.payload_size = payload.size();
+        header.checksum = snapshot_checksum(payload.data(), payload.size());
+
+        ofstream file(filename, ios::binary | ios::trunc);
+        if (!file.write(reinterpret_cast<const char*>(&header), sizeof(header))
+            || !file.write(payload.data(), payload.size())
+            || !file.flush()) {
+            throw runtime_error("Не удалось записать снимок в файл " + filename);
+        }
+    }
+};
+
+/// SnapshotReader
+/// Reads a whole snapshot with one read and validates it. Values are copied
+/// as is when the stored tag matches the requested type and converted
+/// through double otherwise.
+class SnapshotReader {
+private:
+    vector<char>    data;
+    size_t          pos = sizeof(SnapshotHeader);
+
+public:
+    SnapshotHeader  header;
+
+public:
+    explicit SnapshotReader(const string& filename);
+
+    template<typename T>
+    void get(T* out, size_t count, SnapshotTag tag);
+
+    void skip(size_t bytes) {take(bytes);}
+
+private:
+    const char* take(size_t bytes);
+};
+
+
+inline SnapshotReader::SnapshotReader(const string& filename) {
+    ifstream fin(filename, ios::binary | ios::ate);
+    if (!fin) {
+        throw runtime_error("Не удалось открыть файл");
+    }
+    data.resize(fin.tellg());
+    fin.seekg(0);
+    if (!fin.read(data.data(), data.size()) || data.size() < sizeof(SnapshotHeader)) {
+        throw runtime_error("Не удалось прочитать снимок");
+    }
+    memcpy(&header, data.data(), sizeof(header));
+
+    if (memcmp(header.magic, SnapshotHeader::magic_value, sizeof(header.magic)) != 0) {
+        throw runtime_error("Файл не является снимком");
+    }
+    if (header.version < 1 || header.version > SnapshotHeader::current_version
+        || header.header_size != sizeof(SnapshotHeader)) {
+        throw runtime_error("Неподдерживаемая версия снимка");
+    }
+    if (header.payload_size != data.size() - sizeof(SnapshotHeader)) {
+        throw runtime_error("Снимок обрезан");
+    }
+    if (header.checksum != snapshot_checksum(data.data() + sizeof(SnapshotHeader), header.payload_size)) {
+        throw runtime_error("Неверная контрольная сумма снимка");
+    }
+}
+
+inline const char* SnapshotReader::take(size_t bytes) {
+    if (bytes > data.size() - pos) {
+        throw runtime_error("Снимок обрезан");
+    }
+    const char* ans = data.data() + pos;
+    pos += bytes;
+    return ans;
+}
+
+template<typename T>
+void SnapshotReader::get(T* out, size_t count, SnapshotTag tag) {
+    if constexpr (is_integral_v<T>) {
+        memcpy(out, take(count * sizeof(T)), count * sizeof(T));
+    } else {
+        if (tag == snapshot_tag<T>()) {
+            memcpy(out, take(count * sizeof(T)), count * sizeof(T));
+            return;
+        }
+        const char* in = take(count * tag.size);
+        for (size_t i = 0; i < count; ++i, in += tag.size) {
+            double value;
+            if (tag.kind == SnapshotTag::Float && tag.size == sizeof(float)) {
+                float f;
+                memcpy(&f, in, sizeof(f));
+                value = f;
+            } else if (tag.kind == SnapshotTag::Double && tag.size == sizeof(double)) {
+                memcpy(&value, in, sizeof(value));
+            } else if (tag.kind == SnapshotTag::FixedPoint && tag.frac < 64 && (tag.size == 1 || tag.size == 2 || tag.size == 4 || tag.size == 8)) {
+                int64_t raw = 0;
+                switch (tag.size) {
+                    case 1: {int8_t  r; memcpy(&r, in, 1); raw = r; break;}
+                    case 2: {int16_t r; memcpy(&r, in, 2); raw = r; break;}
+                    case 4: {int32_t r; memcpy(&r, in, 4); raw = r; break;}
+                    case 8: {int64_t r; memcpy(&r, in, 8); raw = r; break;}
+                }
+                value = double(raw) / double(uint64_t(1) << tag.frac);
+            } else {
+                throw runtime_error("Неизвестный тип в снимке");
+            }
+            out[i] = T(value);
+        }
+    }
+}
@@ -0,0 +1,110 @@
+#pragma once
+
+#include <atomic>
+#include <cstddef>
+#include <new>
+#include <vector>
+
+using namespace std;
+
+/// SpscQueue<T>
+/// Bounded lock-free queue between one producer thread and one consumer
+/// thread. Slots are allocated once and reused, so a producer can fill a
+/// slot in place (`back` + `push`) and the consumer can read it in place
+/// (`front` + `pop`) without copying. Each side writes only its own index;
+/// the other side reads it with acquire ordering. `wait_back` and
+/// `wait_front` block on the other side's index (C++20 atomic wait); the
+/// notify after every push and pop is cheap while nobody waits.
+template<typename T>
+class SpscQueue {
+private:
+    vector<T>                   slots;
+    // Next slot to fill; written by the producer.
+    alignas(64) atomic<size_t>  head{0};
+    // Next slot to read; written by the consumer.
+    alignas(64) atomic<size_t>  tail{0};
+
+public:
+    explicit SpscQueue(size_t capacity) : slots(capacity) {}
+
+    SpscQueue(const SpscQueue&) = delete;
+    SpscQueue& operator=(const SpscQueue&) = delete;
+
+    size_t capacity() const {return slots.size();}
+
+    /// Producer: the slot to fill next, or nullptr if the queue is full.
+    T* back() {
+        size_t h = head.load(memory_order_relaxed);
+        if (h - tail.load(memory_order_acquire) == slots.size()) {
+            return nullptr;
+        }
+        return &slots[h % slots.size()];
+    }
+
+    /// Producer: like `back`, but waits for the consumer if the queue is full.
+    T* wait_back() {
+        while (true) {
+            if (T* slot = back()) {
+                return slot;
+            }
+            tail.wait(head.load(memory_order_relaxed) - slots.size(), memory_order_acquire);
+        }
+    }
+
+    /// Producer: publishes the slot returned by `back`.
+    void push() {
+        head.store(head.load(memory_order_relaxed) + 1, memory_order_release);
+        head.notify_one();
+    }
+
+    bool try_push(const T& value) {
+        T* slot = back();
+        if (!slot) {
+            return false;
+        }
+        *slot = value;
+        push();
+        return true;
+    }
+
+    /// Consumer: cheap check for the hot loop, a relaxed load of the
+    /// producer index. `front` still has to be called to read.
+    bool maybe_nonempty() const {
+        return head.load(memory_order_relaxed) != tail.load(memory_order_relaxed);
+    }
+
+    /// Consumer: the oldest published slot, or nullptr if there is none.
+    T* front() {
+        size_t t = tail.load(memory_order_relaxed);
+        if (head.load(memory_order_acquire) == t) {
+            return nullptr;
+        }
+        return &slots[t % slots.size()];
+    }
+
+    /// Consumer: like `front`, but waits for the producer if the queue is empty.
+    T* wait_front() {
+        while (true) {
+            if (T* slot = front()) {
+                return slot;
+            }
+            head.wait(tail.load(memory_order_relaxed), memory_order_acquire);
+        }
+    }
+
+    /// Consumer: releases the slot returned by `front` to the producer.
+    void pop() {
+        tail.store(tail.load(memory_order_relaxed) + 1, memory_order_release);
+        tail.notify_one();
+    }
+
+    bool try_pop(T& out) {
+        T* slot = front();
+        if (!slot) {
+            return false;
+        }
+        out = *slot;
+        pop();
+        return true;
+    }
+};
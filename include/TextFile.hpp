@@ -0,0 +1,92 @@
+#pragma once
+
+#include <charconv>
+#include <cstddef>
+#include <string>
+#include <string_view>
+#include <system_error>
+#include <type_traits>
+#include <vector>
+
+using namespace std;
+
+/// TextFile
+/// A text input (.in or .out) mapped into memory and split into lines in
+/// one pass. Lines starting with "//" are comments and are skipped. The
+/// lines stay valid while the file is alive, so row ranges can be parsed
+/// by several threads at once.
+class TextFile {
+private:
+    const char*         data = nullptr;
+    size_t              size = 0;
+    bool                mapped = false;
+    // Contents of a file that cannot be mapped, e.g. a pipe.
+    string              buffer;
+    vector<string_view> lines;
+    size_t              pos = 0;
+
+public:
+    explicit TextFile(const string& filename);
+    ~TextFile();
+
+    TextFile(const TextFile&) = delete;
+    TextFile& operator=(const TextFile&) = delete;
+
+    bool next(string_view& line);
+
+    /// The next `count` lines, or nullptr if the file ends before them.
+    const string_view* take(size_t count);
+};
+
+/// TextRow
+/// Reads whitespace-separated numbers from one line with from_chars.
+/// Fixed-point types are read through double, as their operator>> does.
+class TextRow {
+private:
+    const char* cur;
+    const char* end;
+
+public:
+    explicit TextRow(string_view line) : cur(line.data()), end(line.data() + line.size()) {}
+
+    template<typename T>
+    bool get(T& out);
+
+    /// True if only whitespace is left.
+    bool done() {
+        skip_space();
+        return cur == end;
+    }
+
+private:
+    void skip_space() {
+        while (cur != end && (*cur == ' ' || *cur == '\t' || *cur == '\r')) {
+            ++cur;
+        }
+    }
+};
+
+
+template<typename T>
+bool TextRow::get(T& out) {
+    skip_space();
+    if (cur != end && *cur == '+') {
+        ++cur;
+    }
+    if constexpr (is_arithmetic_v<T>) {
+        auto [ptr, ec] = from_chars(cur, end, out);
+        if (ec != errc{}) {
+            return false;
+        }
+        cur = ptr;
+    } else {
+        double value;
+        auto [ptr, ec] = from_chars(cur, end, value);
+        if (ec != errc{}) {
+            return false;
+        }
+        cur = ptr;
+        out = T(value);
+    }
+    return true;
+}
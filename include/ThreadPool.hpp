@@ -0,0 +1,74 @@
+#pragma once
+
+#include <atomic>
+#include <condition_variable>
+#include <cstddef>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+using namespace std;
+
+/// ThreadPool
+/// Fixed set of workers for data-parallel loops. `parallel_for` splits the
+/// range into chunks of a fixed size and hands them out through a shared
+/// counter, so threads that finish early keep taking chunks from the slow
+/// ones. The calling thread works as well; a pool of size 1 has no workers
+/// and runs everything inline.
+class ThreadPool {
+public:
+    explicit ThreadPool(size_t threads = 1);
+    ~ThreadPool();
+
+    ThreadPool(const ThreadPool&) = delete;
+    ThreadPool& operator=(const ThreadPool&) = delete;
+
+    size_t size() const {return workers.size() + 1;}
+
+    /// Calls f(chunk, lo, hi) for every chunk [lo, hi) of [0, count) with at
+    /// most `grain` items. Chunk boundaries do not depend on the thread count.
+    template<typename F>
+    void parallel_for(size_t count, size_t grain, F&& f);
+
+    static size_t chunks(size_t count, size_t grain) {return (count + grain - 1) / grain;}
+
+private:
+    void worker_loop();
+    void work();
+    void dispatch();
+
+private:
+    vector<thread>          workers;
+    mutex                   mtx;
+    condition_variable      start_cv;
+    condition_variable      done_cv;
+    size_t                  generation = 0;
+    size_t                  active = 0;
+    bool                    stopping = false;
+
+    atomic<size_t>          next_chunk{0};
+    size_t                  job_chunks = 0;
+    void*                   job_ctx = nullptr;
+    void                  (*job_call)(void*, size_t) = nullptr;
+};
+
+
+template<typename F>
+void ThreadPool::parallel_for(size_t count, size_t grain, F&& f) {
+    size_t total = chunks(count, grain);
+    auto run_chunk = [&](size_t k) {
+        size_t lo = k * grain;
+        size_t hi = lo + grain < count ? lo + grain : count;
+        f(k, lo, hi);
+    };
+    if (workers.empty() || total <= 1) {
+        for (size_t k = 0; k < total; ++k) {
+            run_chunk(k);
+        }
+        return;
+    }
+    job_ctx = &run_chunk;
+    job_call = [](void* ctx, size_t k) {(*static_cast<decltype(run_chunk)*>(ctx))(k);};
+    job_chunks = total;
+    dispatch();
+}
@@ -0,0 +1,94 @@
+#pragma once
+
+#include "Arena.hpp"
+#include "Const.hpp"
+
+#include <cstdint>
+#include <vector>
+
+using namespace std;
+
+/// Topology<PType, Storage>
+/// Per-cell tables derived from the field once after loading. Walls never
+/// move, so only `rho` has to follow the particles (see ParticleParams).
+template<typename PType, typename Storage>
+class Topology {
+public:
+    template<typename T>
+    using matrix_t = typename Storage::template matrix<T>;
+
+    // Bit d is set if the neighbour in direction deltas[d] is not a wall.
+    // Always zero for wall cells.
+    matrix_t<uint8_t>   open;
+    // Number of open neighbours.
+    matrix_t<uint8_t>   dirs;
+    // Density of the particle currently occupying the cell.
+    matrix_t<PType>     rho;
+    // One bit per cell, row-major.
+    vector<uint64_t>    walls;
+    // Row-major indices (x * m + y) of all non-wall cells. Particles are
+    // only ever swapped between non-wall cells, so the list never changes.
+    vector<uint32_t>    fluid;
+
+public:
+    Topology() = default;
+
+    template<typename Field>
+    Topology(const Field& field, const PType rho_table[256], size_t n, size_t m);
+
+    // Tables in `arena`, still empty until `build`.
+    Topology(size_t n, size_t m, Arena& arena)
+      : open(arena.matrix<matrix_t<uint8_t>>(n, m)),
+        dirs(arena.matrix<matrix_t<uint8_t>>(n, m)),
+        rho(arena.matrix<matrix_t<PType>>(n, m))
+    {}
+
+    // Fills empty tables from the field.
+    template<typename Field>
+    void build(const Field& field, const PType rho_table[256], size_t n, size_t m);
+
+    bool is_wall(size_t x, size_t y) const {
+        size_t i = x * open.get_m() + y;
+        return (walls[i >> 6] >> (i & 63)) & 1;
+    }
+
+    bool is_open(size_t x, size_t y, size_t dir) const {
+        return (open[x][y] >> dir) & 1;
+    }
+};
+
+
+template<typename PType, typename Storage>
+template<typename Field>
+Topology<PType, Storage>::Topology(const Field& field, const PType rho_table[256], size_t n, size_t m)
+  : open(n, m),
+    dirs(n, m),
+    rho(n, m)
+{
+    build(field, rho_table, n, m);
+}
+
+template<typename PType, typename Storage>
+template<typename Field>
+void Topology<PType, Storage>::build(const Field& field, const PType rho_table[256], size_t n, size_t m) {
+    walls.assign((n * m + 63) / 64, 0);
+    fluid.clear();
+    for (size_t x = 0; x < n; ++x) {
+        for (size_t y = 0; y < m; ++y) {
+            rho[x][y] = rho_table[(int) field[x][y]];
+            size_t i = x * m + y;
+            if (field[x][y] == '#') {
+                walls[i >> 6] |= uint64_t(1) << (i & 63);
+                continue;
+            }
+            fluid.push_back(i);
+            for_each_dir([&](auto d) {
+                constexpr auto dx = deltas[d].first, dy = deltas[d].second;
+                if (field[x + dx][y + dy] != '#') {
+                    open[x][y] |= uint8_t(1) << d;
+                    ++dirs[x][y];
+                }
+            });
+        }
+    }
+}
@@ -0,0 +1,60 @@
+#pragma once
+
+#include <cassert>
+#include <cstddef>
+#include <algorithm>
+#include <vector>
+
+using namespace std;
+
+/// FrameStack<Frame>
+/// Explicit call stack for the depth-first grid traversals in Fluid.
+/// A traversal puts every cell on the stack at most once, so the buffer is
+/// allocated once for the whole grid and pushes never reallocate; frame
+/// references stay valid until the frame is popped. Pushes and the peak
+/// depth are counted for the profiler.
+template<typename Frame>
+class FrameStack {
+private:
+    vector<Frame>   frames;
+    size_t          depth = 0;
+
+public:
+    size_t          pushes = 0;
+    size_t          peak = 0;
+
+public:
+    FrameStack() = default;
+    explicit FrameStack(size_t capacity) : frames(capacity) {}
+
+    Frame& push(const Frame& frame) {
+        assert(depth < frames.size());
+        ++pushes;
+        peak = max(peak, depth + 1);
+        return frames[depth++] = frame;
+    }
+
+    void pop() {
+        assert(depth > 0);
+        --depth;
+    }
+
+    Frame& top() {
+        assert(depth > 0);
+        return frames[depth - 1];
+    }
+
+    /// Frame `i` from the bottom of the stack.
+    Frame& operator[](size_t i) {
+        assert(i < depth);
+        return frames[i];
+    }
+
+    bool empty() const {return depth == 0;}
+
+    size_t size() const {return depth;}
+
+    size_t capacity() const {return frames.size();}
+
+    void reset_stats() {pushes = peak = 0;}
+};
@@ -1,6 +1,7 @@
 #pragma once
 
 #include "Matrix.hpp"
+#include "Arena.hpp"
 #include "Const.hpp"
 
 #include <array>
@@ -10,50 +11,76 @@
 
 using namespace std;
 
-template<typename T>
+/// VectorField<T, Storage>
+/// Per-cell values for every direction in `deltas`, stored as one
+/// contiguous plane per direction (structure of arrays). A phase that only
+/// needs one direction streams through a single plane via `row`.
+template<typename T, typename Storage>
 class VectorField {
 public:
-    unique_ptr<AbstractMatrix<array<T, deltas.size()>>> v = nullptr;
+    using matrix_t = typename Storage::template matrix<T>;
+
+    array<matrix_t, deltas.size()> planes;
 
 public:
-    VectorField(){v = nullptr;}
-    VectorField(size_t N, size_t M) : v(create_matrix<array<T, deltas.size()>>{}(N, M)){}
+    VectorField() = default;
+    VectorField(size_t N, size_t M) {
+        for (auto& plane : planes) {
+            plane = matrix_t(N, M);
+        }
+    }
+    VectorField(size_t N, size_t M, Arena& arena) {
+        for (auto& plane : planes) {
+            plane = arena.matrix<matrix_t>(N, M);
+        }
+    }
 
     void reset();
 
-    T& add(int x, int y, int dx, int dy, T dv);
+    T& add(int x, int y, size_t dir, T dv);
+
+    T& get(int x, int y, size_t dir);
+
+    template<size_t Dir>
+    T& get(int x, int y);
+
+    T* row(size_t dir, size_t x) {return planes[dir][x];}
+
+    const T* row(size_t dir, size_t x) const {return planes[dir][x];}
 
-    T& get(int x, int y, int dx, int dy);
+    void swap_cell(int x, int y, array<T, deltas.size()>& v);
 };
 
 
-template<typename T>
-void VectorField<T>::reset(){
-    v->reset();
+template<typename T, typename Storage>
+void VectorField<T, Storage>::reset(){
+    for (auto& plane : planes) {
+        plane.reset();
+    }
 }
 
-template<typename T>
-T& VectorField<T>::add(int x, int y, int dx, int dy, T dv){
-    assert(v.get() != nullptr);
-    return get(x, y, dx, dy) += dv;
+template<typename T, typename Storage>
+T& VectorField<T, Storage>::add(int x, int y, size_t dir, T dv){
+    return get(x, y, dir) += dv;
 }
 
-template<typename T>
-T& VectorField<T>::get(int x, int y, int dx, int dy) {
-    // int i = 4*dx + dy;
-    // switch(i){
-    // case -1:
-    //     return (*v)[x][y][0];
-    // case 1:
-    //     return (*v)[x][y][1];
-    // case -4:
-    //     return (*v)[x][y][2];
-    // case 4:
-    //     return (*v)[x][y][3]; 
-    // }
-    // int i = ((dy & 1) << 1) | (((dx & 1) & ((dx & 2) >> 1)) | ((dy & 1) & ((dy & 2) >> 1)));
-    assert(v.get() != nullptr);
-    size_t i = ranges::find(deltas, make_pair(dx, dy)) - deltas.begin();
-    assert(i < deltas.size());
-    return (*v)[x][y][i];
-}
\ No newline at end of file
+template<typename T, typename Storage>
+T& VectorField<T, Storage>::get(int x, int y, size_t dir) {
+    assert(dir < deltas.size() && planes[dir].data() != nullptr);
+    return planes[dir][x][y];
+}
+
+template<typename T, typename Storage>
+template<size_t Dir>
+T& VectorField<T, Storage>::get(int x, int y) {
+    static_assert(Dir < deltas.size());
+    assert(planes[Dir].data() != nullptr);
+    return planes[Dir][x][y];
+}
+
+template<typename T, typename Storage>
+void VectorField<T, Storage>::swap_cell(int x, int y, array<T, deltas.size()>& v) {
+    for (size_t i = 0; i < deltas.size(); ++i) {
+        swap(planes[i][x][y], v[i]);
+    }
+}
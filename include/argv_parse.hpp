@@ -1,3 +1,5 @@
+#pragma once
+
 #include <string>
 #include <unordered_map>
 #include <vector>
@@ -8,6 +10,8 @@ struct ArgvParseResult {
     const unordered_map<string, string> named;
 
     const string& get_option(const string& opt_name);
+
+    string get_option(const string& opt_name, const string& default_value);
 };
 
 ArgvParseResult parseArgs(char** argv);
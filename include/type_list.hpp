@@ -107,3 +107,76 @@ template<>
 struct product<> {
     using type = type_list<>;
 };
+
+/// push_back<T, [Ts...]>
+/// Appends T to list.
+/// Example:
+///     push_back<A, [B, C]> -> [B, C, A]
+template<typename... Ts>
+struct push_back;
+
+template<typename T, typename... Ts>
+struct push_back<T, type_list<Ts...>> {
+    using type = type_list<Ts..., T>;
+};
+
+/// push_back_each<[Ts...], [Us...]>
+/// Appends each U to the list, giving one list per U.
+/// Example:
+///     push_back_each<[A, B], [C, D]> -> [[A, B, C], [A, B, D]]
+template<typename... Ts>
+struct push_back_each;
+
+template<is_list L, typename... Us>
+struct push_back_each<L, type_list<Us...>> {
+    using type = type_list<typename push_back<Us, L>::type...>;
+};
+
+/// product_with<[[Ts...]...], [Us...]>
+/// Cartesian product of a list of lists with a list of types.
+/// Example:
+///     product_with<[[A, B], [C, D]], [E, F]> -> [
+///         [A, B, E],
+///         [A, B, F],
+///         [C, D, E],
+///         [C, D, F],
+///     ]
+template<typename... Ts>
+struct product_with;
+
+template<is_list... Ls, typename U>
+struct product_with<type_list<Ls...>, U> {
+    using type = typename concat<typename push_back_each<Ls, U>::type...>::type;
+};
+
+/// flatten<[[Ts...]...]>
+/// Concatenates the lists of a list.
+/// Example:
+///     flatten<[[A, B], [C]]> -> [A, B, C]
+template<typename... Ts>
+struct flatten;
+
+template<is_list... Ls>
+struct flatten<type_list<Ls...>> {
+    using type = typename concat<Ls...>::type;
+};
+
+/// unique_types<[Ts...]>
+/// Removes repeated types, keeping the first occurrence.
+/// Example:
+///     unique_types<[A, B, A, C, B]> -> [A, B, C]
+template<typename L, typename Acc = type_list<>>
+struct unique_types;
+
+template<typename... As>
+struct unique_types<type_list<>, type_list<As...>> {
+    using type = type_list<As...>;
+};
+
+template<typename T, typename... Ts, typename... As>
+struct unique_types<type_list<T, Ts...>, type_list<As...>> {
+    using type = typename unique_types<
+            type_list<Ts...>,
+            conditional_t<(is_same_v<T, As> || ...), type_list<As...>, type_list<As..., T>>
+        >::type;
+};
@@ -65,3 +65,22 @@ public:
         return false;
     }
 };
+
+/// run_for_each<F, [[Ms...]...]>
+/// Calls func.execute<Ms...>() with the markers themselves for every list.
+template<typename... Ts>
+struct run_for_each;
+
+template<typename F, is_type_marker_list... Ls>
+struct run_for_each<F, type_list<Ls...>> {
+public:
+    void operator()(F& func) {
+        (helper(func, Ls{}), ...);
+    }
+
+private:
+    template<is_type_marker... Ms>
+    static void helper(F& func, type_list<Ms...>) {
+        func.template execute<Ms...>();
+    }
+};
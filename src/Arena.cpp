@@ -0,0 +1,55 @@
+#include "Arena.hpp"
+
+#include <algorithm>
+#include <cstdint>
+#include <new>
+
+#include <sys/mman.h>
+
+using namespace std;
+
+Arena::Arena(size_t bytes) {
+    bytes = max(bytes, size_t(1));
+    bool huge = bytes >= huge_page;
+    // Room to align the start of the region to a huge page.
+    mapped = huge ? bytes + huge_page : bytes;
+    mapping = mmap(nullptr, mapped, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+    if (mapping == MAP_FAILED) {
+        mapping = nullptr;
+        throw bad_alloc();
+    }
+    uintptr_t start = reinterpret_cast<uintptr_t>(mapping);
+    if (huge) {
+        start = (start + huge_page - 1) / huge_page * huge_page;
+#ifdef MADV_HUGEPAGE
+        madvise(reinterpret_cast<void*>(start), bytes, MADV_HUGEPAGE);
+#endif
+    }
+    base = reinterpret_cast<char*>(start);
+    capacity = bytes;
+}
+
+Arena::~Arena() {
+    release();
+}
+
+Arena& Arena::operator=(Arena&& other) noexcept {
+    if (this != &other) {
+        release();
+        mapping = exchange(other.mapping, nullptr);
+        mapped = exchange(other.mapped, 0);
+        base = exchange(other.base, nullptr);
+        capacity = exchange(other.capacity, 0);
+        used = exchange(other.used, 0);
+    }
+    return *this;
+}
+
+void Arena::release() {
+    if (mapping) {
+        munmap(mapping, mapped);
+    }
+    mapping = nullptr;
+    base = nullptr;
+    mapped = capacity = used = 0;
+}
@@ -0,0 +1,69 @@
+#include "Checkpointer.hpp"
+
+#include <cstdio>
+#include <exception>
+#include <iostream>
+
+using namespace std;
+
+Checkpointer::Checkpointer(string filename)
+  : filename(move(filename)),
+    writer(&Checkpointer::writer_loop, this)
+{}
+
+Checkpointer::~Checkpointer() {
+    {
+        lock_guard lock(mtx);
+        stopping = true;
+    }
+    cv.notify_all();
+    writer.join();
+}
+
+Checkpointer::Slot& Checkpointer::acquire() {
+    lock_guard lock(mtx);
+    int k = writing == 0 ? 1 : 0;
+    if (ready == k) {
+        // Not picked up yet; the new checkpoint supersedes it.
+        ready = none;
+    }
+    return slots[k];
+}
+
+void Checkpointer::submit(Slot& slot) {
+    {
+        lock_guard lock(mtx);
+        ready = int(&slot - slots.data());
+    }
+    cv.notify_all();
+}
+
+void Checkpointer::writer_loop() {
+    const string tmp = filename + ".tmp";
+    while (true) {
+        int k;
+        {
+            unique_lock lock(mtx);
+            cv.wait(lock, [this] {return stopping || ready != none;});
+            if (ready == none) {
+                return;
+            }
+            k = writing = ready;
+            ready = none;
+        }
+
+        const Slot& slot = slots[k];
+        try {
+            slot.payload.write(tmp, slot.header);
+            if (rename(tmp.c_str(), filename.c_str()) != 0) {
+                throw runtime_error("Не удалось переименовать " + tmp + " в " + filename);
+            }
+            cerr << "Сохранено: тик " << slot.header.tick << ", файл " << filename << endl;
+        } catch (const exception& e) {
+            cerr << e.what() << endl;
+        }
+
+        lock_guard lock(mtx);
+        writing = none;
+    }
+}
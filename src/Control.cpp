@@ -0,0 +1,101 @@
+#include "Control.hpp"
+
+#include <cerrno>
+#include <iostream>
+#include <sstream>
+#include <stdexcept>
+
+#include <fcntl.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+using namespace std;
+
+ControlChannel::ControlChannel(string path) : path(move(path)) {
+    struct stat st;
+    if (stat(this->path.c_str(), &st) == 0) {
+        if (!S_ISFIFO(st.st_mode)) {
+            throw runtime_error("Файл управления не является каналом: " + this->path);
+        }
+    } else if (mkfifo(this->path.c_str(), 0600) == 0) {
+        created = true;
+    } else {
+        throw runtime_error("Не удалось создать канал управления " + this->path);
+    }
+    // Opened for writing as well, so that the open does not wait for a
+    // writer and reads do not see end of file between two writers.
+    fd = open(this->path.c_str(), O_RDWR | O_CLOEXEC);
+    if (fd < 0) {
+        if (created) {
+            unlink(this->path.c_str());
+        }
+        throw runtime_error("Не удалось открыть канал управления " + this->path);
+    }
+    reader = thread(&ControlChannel::reader_loop, this);
+}
+
+ControlChannel::~ControlChannel() {
+    stopping = true;
+    // Wakes the reader blocked in read().
+    char wake = '\n';
+    (void) !write(fd, &wake, 1);
+    reader.join();
+    close(fd);
+    if (created) {
+        unlink(path.c_str());
+    }
+}
+
+void ControlChannel::reader_loop() {
+    string line;
+    char buffer[256];
+    while (!stopping) {
+        ssize_t got = read(fd, buffer, sizeof(buffer));
+        if (got < 0 && errno == EINTR) {
+            continue;
+        }
+        if (got <= 0) {
+            return;
+        }
+        for (ssize_t k = 0; k < got && !stopping; ++k) {
+            if (buffer[k] != '\n') {
+                line.push_back(buffer[k]);
+                continue;
+            }
+            parse(line);
+            line.clear();
+        }
+    }
+}
+
+void ControlChannel::parse(const string& line) {
+    stringstream ss{line};
+    string word;
+    if (!(ss >> word)) {
+        return;
+    }
+    ControlMessage message;
+    if (word == "snapshot") {
+        message.command = ControlCommand::Snapshot;
+    } else if (word == "pause") {
+        message.command = ControlCommand::Pause;
+    } else if (word == "resume") {
+        message.command = ControlCommand::Resume;
+    } else if (word == "counters") {
+        message.command = ControlCommand::Counters;
+    } else if (word == "stop") {
+        message.command = ControlCommand::Stop;
+    } else if (word == "render") {
+        message.command = ControlCommand::RenderEvery;
+        if (!(ss >> message.value) || message.value == 0) {
+            cerr << "Неверная команда: " << line << endl;
+            return;
+        }
+    } else {
+        cerr << "Неизвестная команда: " << line << endl;
+        return;
+    }
+    if (!queue.try_push(message)) {
+        cerr << "Очередь команд переполнена, команда пропущена: " << line << endl;
+    }
+}
@@ -0,0 +1,182 @@
+#include "FluidOptions.hpp"
+
+#include <sstream>
+#include <stdexcept>
+
+using namespace std;
+
+namespace {
+
+size_t parse_size(const string& name, const string& value) {
+    size_t pos = 0;
+    unsigned long long ans = 0;
+    try {
+        ans = stoull(value, &pos);
+    } catch (const exception&) {
+        pos = 0;
+    }
+    if (pos == 0 || pos != value.size() || value.starts_with('-')) {
+        stringstream ss;
+        ss << "Неверное значение опции " << name << ": " << value;
+        throw runtime_error(ss.str());
+    }
+    return ans;
+}
+
+double parse_double(const string& name, const string& value) {
+    size_t pos = 0;
+    double ans = 0;
+    try {
+        ans = stod(value, &pos);
+    } catch (const exception&) {
+        pos = 0;
+    }
+    if (pos == 0 || pos != value.size() || !(ans >= 0)) {
+        stringstream ss;
+        ss << "Неверное значение опции " << name << ": " << value;
+        throw runtime_error(ss.str());
+    }
+    return ans;
+}
+
+}
+
+FluidOptions parseFluidOptions(ArgvParseResult& opts) {
+    FluidOptions ans;
+    ans.filename        = opts.get_option("file");
+    ans.save_filename   = opts.get_option("savefile", "");
+    ans.need_save       = !ans.save_filename.empty();
+
+    // Text only for the export extensions unless asked explicitly.
+    const bool text_ext = ans.save_filename.ends_with(".out") || ans.save_filename.ends_with(".txt");
+    const string save_format = opts.get_option("save-format", text_ext ? "text" : "binary");
+    if (save_format == "text") {
+        ans.save_format = SaveFormat::Text;
+    } else if (save_format == "binary") {
+        ans.save_format = SaveFormat::Binary;
+    } else {
+        throw runtime_error("Неверное значение опции save-format: " + save_format);
+    }
+    ans.checkpoint_every = parse_size("checkpoint-every", opts.get_option("checkpoint-every", "0"));
+    if (ans.checkpoint_every != 0 && !ans.need_save) {
+        throw runtime_error("Опция checkpoint-every требует savefile");
+    }
+
+    ans.threads = parse_size("threads", opts.get_option("threads", "1"));
+    if (ans.threads == 0) {
+        throw runtime_error("Неверное значение опции threads: 0");
+    }
+
+    const string flow_mode = opts.get_option("flow-mode", "serial");
+    if (flow_mode == "serial") {
+        ans.flow_mode = FlowMode::Serial;
+    } else if (flow_mode == "tiled") {
+        ans.flow_mode = FlowMode::Tiled;
+    } else {
+        throw runtime_error("Неверное значение опции flow-mode: " + flow_mode);
+    }
+    ans.flow_tile = parse_size("flow-tile", opts.get_option("flow-tile", "32"));
+    if (ans.flow_tile == 0) {
+        throw runtime_error("Неверное значение опции flow-tile: 0");
+    }
+    const string flow_solver = opts.get_option("flow-solver", "dfs");
+    if (flow_solver == "dfs") {
+        ans.flow_solver = FlowSolver::Dfs;
+    } else if (flow_solver == "dinic") {
+        ans.flow_solver = FlowSolver::Dinic;
+    } else {
+        throw runtime_error("Неверное значение опции flow-solver: " + flow_solver);
+    }
+    if (ans.flow_solver != FlowSolver::Dfs && ans.flow_mode == FlowMode::Tiled) {
+        throw runtime_error("Опция flow-mode=tiled работает только с flow-solver=dfs");
+    }
+
+    const string output = opts.get_option("output", "text");
+    if (output == "none") {
+        ans.output = OutputMode::None;
+    } else if (output == "text") {
+        ans.output = OutputMode::Text;
+    } else if (output == "binary") {
+        ans.output = OutputMode::Binary;
+    } else {
+        throw runtime_error("Неверное значение опции output: " + output);
+    }
+    ans.render_every = parse_size("render-every", opts.get_option("render-every", "1"));
+    if (ans.render_every == 0) {
+        throw runtime_error("Неверное значение опции render-every: 0");
+    }
+
+    ans.output_queue = parse_size("output-queue", opts.get_option("output-queue", "8"));
+    const string policy = opts.get_option("output-policy", "block");
+    if (policy == "block") {
+        ans.output_policy = OutputPolicy::Block;
+    } else if (policy == "drop") {
+        ans.output_policy = OutputPolicy::Drop;
+    } else {
+        throw runtime_error("Неверное значение опции output-policy: " + policy);
+    }
+
+    const string roi = opts.get_option("roi", "");
+    if (!roi.empty()) {
+        size_t bounds[4];
+        size_t begin = 0;
+        for (size_t k = 0; k < 4; ++k) {
+            size_t end = k < 3 ? roi.find(',', begin) : roi.size();
+            if (end == string::npos) {
+                throw runtime_error("Неверное значение опции roi: " + roi);
+            }
+            bounds[k] = parse_size("roi", roi.substr(begin, end - begin));
+            begin = end + 1;
+        }
+        ans.has_roi = true;
+        ans.roi = {bounds[0], bounds[1], bounds[2], bounds[3]};
+        if (ans.roi.x0 >= ans.roi.x1 || ans.roi.y0 >= ans.roi.y1) {
+            throw runtime_error("Неверное значение опции roi: " + roi);
+        }
+    }
+
+    ans.record_filename = opts.get_option("record", "");
+    ans.record_keyframe = parse_size("record-keyframe", opts.get_option("record-keyframe", "100"));
+    if (ans.record_keyframe == 0) {
+        throw runtime_error("Неверное значение опции record-keyframe: 0");
+    }
+    const string record_keyframes = opts.get_option("record-keyframes", "field");
+    if (record_keyframes == "field") {
+        ans.record_full = false;
+    } else if (record_keyframes == "full") {
+        ans.record_full = true;
+    } else {
+        throw runtime_error("Неверное значение опции record-keyframes: " + record_keyframes);
+    }
+
+    ans.max_ticks    = parse_size("max-ticks", opts.get_option("max-ticks", "0"));
+    ans.time_limit   = parse_double("time-limit", opts.get_option("time-limit", "0"));
+    ans.steady_ticks = parse_size("steady-ticks", opts.get_option("steady-ticks", "0"));
+    ans.steady_tol   = parse_double("steady-tol", opts.get_option("steady-tol", "1e-4"));
+
+    ans.dirty_tiles  = opts.get_option("dirty-tiles", "0") == "1";
+    ans.dirty_tile   = parse_size("dirty-tile", opts.get_option("dirty-tile", "16"));
+    if (ans.dirty_tile == 0) {
+        throw runtime_error("Неверное значение опции dirty-tile: 0");
+    }
+    ans.dirty_tol    = parse_double("dirty-tol", opts.get_option("dirty-tol", "1e-4"));
+    ans.verify_tiles = opts.get_option("verify-tiles", "0") == "1";
+
+    ans.profile_filename = opts.get_option("profile", "");
+    ans.control_path = opts.get_option("control", "");
+
+    const string rng = opts.get_option("rng", "counter");
+    if (rng == "counter") {
+        ans.rng = RngMode::Counter;
+    } else if (rng == "mt19937") {
+        ans.rng = RngMode::Mt19937;
+    } else {
+        throw runtime_error("Неверное значение опции rng: " + rng);
+    }
+    ans.seed = parse_size("seed", opts.get_option("seed", "1337"));
+
+    if (ans.verify_tiles && (!ans.dirty_tiles || ans.rng != RngMode::Counter)) {
+        throw runtime_error("Опция verify-tiles требует dirty-tiles=1 и rng=counter");
+    }
+    return ans;
+}
@@ -0,0 +1,211 @@
+#include "Output.hpp"
+#include "SpscQueue.hpp"
+
+#include <atomic>
+#include <cstdint>
+#include <cstring>
+#include <exception>
+#include <iostream>
+#include <stdexcept>
+#include <string>
+#include <thread>
+#include <vector>
+
+using namespace std;
+
+namespace {
+
+class WindowSink : public OutputSink {
+protected:
+    bool    has_roi;
+    Roi     roi{};
+    string  buffer;
+
+public:
+    explicit WindowSink(const Roi* roi) : has_roi(roi != nullptr) {
+        if (roi) {
+            this->roi = *roi;
+        }
+    }
+
+protected:
+    Roi window(const FieldView& field) const {
+        if (!has_roi) {
+            return {0, 0, field.rows, field.cols};
+        }
+        if (roi.x1 > field.rows || roi.y1 > field.cols) {
+            throw runtime_error("Окно roi выходит за пределы поля");
+        }
+        return roi;
+    }
+
+    void flush() {
+        cout.write(buffer.data(), buffer.size());
+        cout.flush();
+    }
+};
+
+class TextSink : public WindowSink {
+public:
+    using WindowSink::WindowSink;
+
+    void frame(size_t tick, const FieldView& field) override {
+        Roi w = window(field);
+        buffer = "Tick " + to_string(tick) + ":\n";
+        for (size_t x = w.x0; x < w.x1; ++x) {
+            buffer.append(field.data + x * field.stride + w.y0, w.y1 - w.y0);
+            buffer += '\n';
+        }
+        flush();
+    }
+};
+
+class BinarySink : public WindowSink {
+public:
+    using WindowSink::WindowSink;
+
+    void frame(size_t tick, const FieldView& field) override {
+        Roi w = window(field);
+        uint64_t tick64 = tick;
+        uint32_t rows = w.x1 - w.x0, cols = w.y1 - w.y0;
+        buffer.resize(sizeof(tick64) + sizeof(rows) + sizeof(cols) + size_t(rows) * cols);
+        char* out = buffer.data();
+        memcpy(out, &tick64, sizeof(tick64)); out += sizeof(tick64);
+        memcpy(out, &rows, sizeof(rows));     out += sizeof(rows);
+        memcpy(out, &cols, sizeof(cols));     out += sizeof(cols);
+        for (size_t x = w.x0; x < w.x1; ++x, out += cols) {
+            memcpy(out, field.data + x * field.stride + w.y0, cols);
+        }
+        flush();
+    }
+};
+
+class NullSink : public OutputSink {
+public:
+    void frame(size_t, const FieldView&) override {}
+
+    void finish(size_t ticks, size_t cells, chrono::duration<double> elapsed) override {
+        double seconds = elapsed.count();
+        cout << "Тиков: " << ticks << ", время: " << seconds << " с";
+        if (seconds > 0) {
+            cout << ", тиков/с: " << ticks / seconds << ", клеток/с: " << double(ticks) * cells / seconds;
+        }
+        cout << endl;
+    }
+};
+
+/// Runs another sink on a writer thread. `frame` copies the field into the
+/// next free buffer of the ring and returns; a full ring blocks or drops
+/// the frame by policy. An error of the writer is rethrown by the next call
+/// on the simulation thread.
+class AsyncSink : public OutputSink {
+private:
+    struct Frame {
+        size_t          tick = 0;
+        // The last frame; tells the writer to exit.
+        bool            end = false;
+        size_t          rows = 0, cols = 0;
+        vector<char>    data;
+    };
+
+    unique_ptr<OutputSink>  inner;
+    OutputPolicy            policy;
+    SpscQueue<Frame>        queue;
+    size_t                  dropped = 0;
+    // Set by the writer; `failed` is raised once `error` is written.
+    exception_ptr           error;
+    atomic<bool>            failed{false};
+    bool                    reported = false;
+    thread                  writer;
+
+public:
+    AsyncSink(unique_ptr<OutputSink> inner, size_t queue, OutputPolicy policy)
+      : inner(move(inner)),
+        policy(policy),
+        queue(queue),
+        writer(&AsyncSink::writer_loop, this)
+    {}
+
+    ~AsyncSink() override {
+        close();
+    }
+
+    void frame(size_t tick, const FieldView& field) override {
+        rethrow();
+        Frame* slot = policy == OutputPolicy::Block ? queue.wait_back() : queue.back();
+        if (!slot) {
+            ++dropped;
+            return;
+        }
+        slot->tick = tick;
+        slot->rows = field.rows;
+        slot->cols = field.cols;
+        slot->data.resize(field.rows * field.cols);
+        for (size_t x = 0; x < field.rows; ++x) {
+            memcpy(slot->data.data() + x * field.cols, field.data + x * field.stride, field.cols);
+        }
+        queue.push();
+    }
+
+    void finish(size_t ticks, size_t cells, chrono::duration<double> elapsed) override {
+        close();
+        rethrow();
+        if (dropped) {
+            cerr << "Пропущено кадров: " << dropped << endl;
+        }
+        inner->finish(ticks, cells, elapsed);
+    }
+
+private:
+    void writer_loop() {
+        while (true) {
+            Frame* slot = queue.wait_front();
+            if (slot->end) {
+                queue.pop();
+                return;
+            }
+            if (!failed.load(memory_order_relaxed)) {
+                try {
+                    inner->frame(slot->tick, {slot->data.data(), slot->cols, slot->rows, slot->cols});
+                } catch (...) {
+                    error = current_exception();
+                    failed.store(true, memory_order_release);
+                }
+            }
+            queue.pop();
+        }
+    }
+
+    // Lets the writer drain the ring and exit.
+    void close() {
+        if (!writer.joinable()) {
+            return;
+        }
+        queue.wait_back()->end = true;
+        queue.push();
+        writer.join();
+    }
+
+    void rethrow() {
+        if (!reported && failed.load(memory_order_acquire)) {
+            reported = true;
+            rethrow_exception(error);
+        }
+    }
+};
+
+}
+
+unique_ptr<OutputSink> make_output_sink(OutputMode mode, const Roi* roi, size_t queue, OutputPolicy policy) {
+    unique_ptr<OutputSink> sink;
+    switch (mode) {
+        case OutputMode::None:   return make_unique<NullSink>();
+        case OutputMode::Text:   sink = make_unique<TextSink>(roi); break;
+        case OutputMode::Binary: sink = make_unique<BinarySink>(roi); break;
+        default:                 throw runtime_error("Неизвестный режим вывода");
+    }
+    if (queue == 0) {
+        return sink;
+    }
+    return make_unique<AsyncSink>(move(sink), queue, policy);
+}
@@ -0,0 +1,115 @@
+#include "Profiler.hpp"
+
+#include <algorithm>
+#include <cmath>
+#include <iomanip>
+#include <sstream>
+#include <stdexcept>
+
+using namespace std;
+
+namespace {
+
+const char* phase_names[] = {
+    "external_forces",
+    "p_forces",
+    "flow",
+    "recalculate_p",
+    "move",
+    "output",
+};
+
+}
+
+void Profiler::Summary::add(double value) {
+    ++count;
+    total += value;
+    max = std::max(max, value);
+}
+
+Profiler::Profiler(const string& filename)
+  : trace(filename, ios::trunc),
+    origin(clock::now())
+{
+    if (!trace) {
+        throw runtime_error("Не удалось открыть файл профиля " + filename);
+    }
+    csv_filename = filename;
+    if (csv_filename.ends_with(".json")) {
+        csv_filename.resize(csv_filename.size() - 5);
+    }
+    csv_filename += ".csv";
+    trace << "{\"displayTimeUnit\": \"ms\", \"traceEvents\": [\n";
+}
+
+Profiler::~Profiler() {
+    trace << "\n]}\n";
+
+    ofstream csv(csv_filename, ios::trunc);
+    csv << fixed << setprecision(3);
+    csv << "metric,count,total,mean,max\n";
+    auto row = [&](const string& name, const Summary& s) {
+        csv << name << "," << s.count << "," << s.total << "," << (s.count ? s.total / s.count : 0) << "," << s.max << "\n";
+    };
+    row("tick_us", ticks);
+    for (size_t k = 0; k < phases.size(); ++k) {
+        row(string(phase_names[k]) + "_us", phases[k]);
+    }
+    row("flow_sweeps", flow_sweeps);
+    row("dfs_nodes", dfs_nodes);
+    row("max_depth", max_depth);
+    row("moved", moved);
+    row("abs_total_delta_p", total_delta_p);
+}
+
+double Profiler::micros(clock::time_point t) const {
+    return chrono::duration<double, micro>(t - origin).count();
+}
+
+void Profiler::event(const string& text) {
+    if (!first_event) {
+        trace << ",\n";
+    }
+    first_event = false;
+    trace << text;
+}
+
+void Profiler::begin_tick(size_t tick) {
+    this->tick = tick;
+    tick_start = clock::now();
+}
+
+void Profiler::phase(ProfilePhase phase, clock::time_point start, clock::time_point end) {
+    double duration = chrono::duration<double, micro>(end - start).count();
+    phases[size_t(phase)].add(duration);
+
+    stringstream ss;
+    ss << fixed << setprecision(3);
+    ss << "{\"name\": \"" << phase_names[size_t(phase)] << "\", \"cat\": \"phase\", \"ph\": \"X\", \"pid\": 1, \"tid\": 1"
+       << ", \"ts\": " << micros(start) << ", \"dur\": " << duration << ", \"args\": {\"tick\": " << tick << "}}";
+    event(ss.str());
+}
+
+void Profiler::end_tick(const TickCounters& counters) {
+    auto end = clock::now();
+    double duration = chrono::duration<double, micro>(end - tick_start).count();
+    ticks.add(duration);
+    flow_sweeps.add(counters.flow_sweeps);
+    dfs_nodes.add(counters.dfs_nodes);
+    max_depth.add(counters.max_depth);
+    moved.add(counters.moved);
+    total_delta_p.add(fabs(counters.total_delta_p));
+
+    stringstream ss;
+    ss << fixed << setprecision(3);
+    ss << "{\"name\": \"tick\", \"cat\": \"tick\", \"ph\": \"X\", \"pid\": 1, \"tid\": 0"
+       << ", \"ts\": " << micros(tick_start) << ", \"dur\": " << duration << ", \"args\": {\"tick\": " << tick << "}},\n"
+       << "{\"name\": \"counters\", \"ph\": \"C\", \"pid\": 1, \"ts\": " << micros(tick_start)
+       << ", \"args\": {\"flow_sweeps\": " << counters.flow_sweeps
+       << ", \"dfs_nodes\": " << counters.dfs_nodes
+       << ", \"max_depth\": " << counters.max_depth
+       << ", \"moved\": " << counters.moved << "}},\n"
+       << "{\"name\": \"total_delta_p\", \"ph\": \"C\", \"pid\": 1, \"ts\": " << micros(tick_start)
+       << ", \"args\": {\"value\": " << counters.total_delta_p << "}}";
+    event(ss.str());
+}
@@ -0,0 +1,209 @@
+#include "Recording.hpp"
+
+#include <algorithm>
+#include <cstring>
+#include <stdexcept>
+
+using namespace std;
+
+namespace {
+
+template<typename T>
+void append(string& buffer, const T& value) {
+    buffer.append(reinterpret_cast<const char*>(&value), sizeof(value));
+}
+
+template<typename T>
+void read_value(ifstream& fin, T& value) {
+    if (!fin.read(reinterpret_cast<char*>(&value), sizeof(value))) {
+        throw runtime_error("Запись обрезана");
+    }
+}
+
+}
+
+Recorder::Recorder(const string& filename, RecordingHeader header)
+  : header(header),
+    file(filename, ios::binary | ios::trunc),
+    shadow(header.n * header.m),
+    touched_flags(header.n * header.m)
+{
+    if (!file) {
+        throw runtime_error("Не удалось открыть файл записи " + filename);
+    }
+    memcpy(this->header.magic, RecordingHeader::magic_value, sizeof(header.magic));
+    this->header.version = RecordingHeader::current_version;
+    this->header.header_size = sizeof(RecordingHeader);
+    file.write(reinterpret_cast<const char*>(&this->header), sizeof(this->header));
+}
+
+Recorder::~Recorder() {
+    uint64_t index_offset = file.tellp();
+    buffer.clear();
+    for (auto [tick, offset] : index) {
+        append(buffer, tick);
+        append(buffer, offset);
+    }
+    append(buffer, uint64_t(index.size()));
+    append(buffer, index_offset);
+    buffer.append(RecordingHeader::index_magic, sizeof(RecordingHeader::index_magic));
+    file.write(buffer.data(), buffer.size());
+}
+
+void Recorder::keyframe(size_t tick, const FieldView& field, initializer_list<pair<const void*, size_t>> extra) {
+    for (size_t x = 0; x < field.rows; ++x) {
+        memcpy(shadow.data() + x * field.cols, field.data + x * field.stride, field.cols);
+    }
+    for (uint32_t cell : touched) {
+        touched_flags[cell] = 0;
+    }
+    touched.clear();
+
+    uint64_t size = shadow.size();
+    for (auto [data, bytes] : extra) {
+        size += bytes;
+    }
+    index.push_back({tick, uint64_t(file.tellp())});
+
+    buffer.clear();
+    append(buffer, uint8_t(RecordKind::Keyframe));
+    append(buffer, uint64_t(tick));
+    append(buffer, size);
+    buffer.append(shadow.data(), shadow.size());
+    for (auto [data, bytes] : extra) {
+        buffer.append(static_cast<const char*>(data), bytes);
+    }
+    file.write(buffer.data(), buffer.size());
+}
+
+void Recorder::end_tick(size_t tick, const FieldView& field, bool moved) {
+    buffer.clear();
+    append(buffer, uint8_t(RecordKind::Delta));
+    append(buffer, uint64_t(tick));
+    append(buffer, uint32_t(0));
+    uint32_t count = 0;
+    for (uint32_t cell : touched) {
+        touched_flags[cell] = 0;
+        char c = field.data[cell / field.cols * field.stride + cell % field.cols];
+        if (c != shadow[cell]) {
+            shadow[cell] = c;
+            append(buffer, cell);
+            append(buffer, c);
+            ++count;
+        }
+    }
+    touched.clear();
+    if (moved || count != 0) {
+        memcpy(buffer.data() + sizeof(uint8_t) + sizeof(uint64_t), &count, sizeof(count));
+        file.write(buffer.data(), buffer.size());
+    }
+}
+
+
+RecordingReader::RecordingReader(const string& filename) : fin(filename, ios::binary) {
+    if (!fin) {
+        throw runtime_error("Не удалось открыть файл");
+    }
+    read_value(fin, header);
+    if (memcmp(header.magic, RecordingHeader::magic_value, sizeof(header.magic)) != 0) {
+        throw runtime_error("Файл не является записью");
+    }
+    if (header.version != RecordingHeader::current_version || header.header_size != sizeof(RecordingHeader)) {
+        throw runtime_error("Неподдерживаемая версия записи");
+    }
+
+    uint64_t count;
+    char magic[sizeof(RecordingHeader::index_magic)];
+    fin.seekg(-int64_t(2 * sizeof(uint64_t) + sizeof(magic)), ios::end);
+    read_value(fin, count);
+    read_value(fin, records_end);
+    read_value(fin, magic);
+    if (memcmp(magic, RecordingHeader::index_magic, sizeof(magic)) != 0) {
+        throw runtime_error("Запись не завершена: нет индекса");
+    }
+    index.resize(count);
+    fin.seekg(records_end);
+    for (auto& [tick, offset] : index) {
+        read_value(fin, tick);
+        read_value(fin, offset);
+    }
+    if (index.empty()) {
+        throw runtime_error("В записи нет ключевых кадров");
+    }
+    cells.resize(header.n * header.m);
+    seek(index.front().first);
+}
+
+bool RecordingReader::read_record_head(uint8_t& kind, uint64_t& tick) {
+    if (uint64_t(fin.tellg()) >= records_end) {
+        return false;
+    }
+    read_value(fin, kind);
+    read_value(fin, tick);
+    return true;
+}
+
+void RecordingReader::read_keyframe() {
+    uint64_t size;
+    read_value(fin, size);
+    if (size < cells.size() || !fin.read(cells.data(), cells.size())) {
+        throw runtime_error("Запись обрезана");
+    }
+    fin.seekg(size - cells.size(), ios::cur);
+}
+
+void RecordingReader::read_delta() {
+    uint32_t count;
+    read_value(fin, count);
+    for (uint32_t i = 0; i < count; ++i) {
+        uint32_t cell;
+        char c;
+        read_value(fin, cell);
+        read_value(fin, c);
+        if (cell >= cells.size()) {
+            throw runtime_error("Неверный номер клетки в записи");
+        }
+        cells[cell] = c;
+    }
+}
+
+void RecordingReader::seek(size_t tick) {
+    auto it = upper_bound(index.begin(), index.end(), tick, [](size_t t, const auto& e) {return t < e.first;});
+    if (it != index.begin()) {
+        --it;
+    }
+    fin.clear();
+    fin.seekg(it->second);
+
+    uint8_t kind;
+    uint64_t t;
+    read_record_head(kind, t);
+    read_keyframe();
+    while (true) {
+        auto pos = fin.tellg();
+        if (!read_record_head(kind, t) || t >= tick) {
+            fin.seekg(pos);
+            return;
+        }
+        if (kind == RecordKind::Keyframe) {
+            read_keyframe();
+        } else {
+            read_delta();
+        }
+    }
+}
+
+bool RecordingReader::next(size_t& tick) {
+    uint8_t kind;
+    uint64_t t;
+    while (read_record_head(kind, t)) {
+        if (kind == RecordKind::Keyframe) {
+            read_keyframe();
+            continue;
+        }
+        read_delta();
+        tick = t;
+        return true;
+    }
+    return false;
+}
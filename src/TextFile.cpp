@@ -0,0 +1,78 @@
+#include "TextFile.hpp"
+
+#include <cstring>
+#include <fstream>
+#include <sstream>
+#include <stdexcept>
+
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+using namespace std;
+
+TextFile::TextFile(const string& filename) {
+    int fd = open(filename.c_str(), O_RDONLY);
+    if (fd < 0) {
+        throw runtime_error("Не удалось открыть файл");
+    }
+    struct stat st;
+    if (fstat(fd, &st) == 0 && S_ISREG(st.st_mode) && st.st_size > 0) {
+        void* addr = mmap(nullptr, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+        if (addr != MAP_FAILED) {
+            data = static_cast<const char*>(addr);
+            size = st.st_size;
+            mapped = true;
+        }
+    }
+    close(fd);
+    if (!mapped) {
+        ifstream fin(filename, ios::binary);
+        if (!fin) {
+            throw runtime_error("Не удалось открыть файл");
+        }
+        ostringstream contents;
+        contents << fin.rdbuf();
+        buffer = contents.str();
+        data = buffer.data();
+        size = buffer.size();
+    }
+
+    const char* cur = data;
+    const char* end = data + size;
+    while (cur != end) {
+        const char* eol = static_cast<const char*>(memchr(cur, '\n', end - cur));
+        if (!eol) {
+            eol = end;
+        }
+        string_view line(cur, eol - cur);
+        if (!line.starts_with("//")) {
+            lines.push_back(line);
+        }
+        cur = eol == end ? end : eol + 1;
+    }
+}
+
+TextFile::~TextFile() {
+    if (mapped) {
+        munmap(const_cast<char*>(data), size);
+    }
+}
+
+bool TextFile::next(string_view& line) {
+    if (pos == lines.size()) {
+        return false;
+    }
+    line = lines[pos++];
+    return true;
+}
+
+const string_view* TextFile::take(size_t count) {
+    if (count > lines.size() - pos) {
+        return nullptr;
+    }
+    const string_view* ans = lines.data() + pos;
+    pos += count;
+    return ans;
+}
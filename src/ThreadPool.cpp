@@ -0,0 +1,62 @@
+#include "ThreadPool.hpp"
+
+using namespace std;
+
+ThreadPool::ThreadPool(size_t threads) {
+    for (size_t i = 1; i < threads; ++i) {
+        workers.emplace_back(&ThreadPool::worker_loop, this);
+    }
+}
+
+ThreadPool::~ThreadPool() {
+    {
+        lock_guard lock(mtx);
+        stopping = true;
+    }
+    start_cv.notify_all();
+    for (auto& worker : workers) {
+        worker.join();
+    }
+}
+
+void ThreadPool::work() {
+    size_t k;
+    while ((k = next_chunk.fetch_add(1, memory_order_relaxed)) < job_chunks) {
+        job_call(job_ctx, k);
+    }
+}
+
+void ThreadPool::dispatch() {
+    {
+        lock_guard lock(mtx);
+        next_chunk.store(0, memory_order_relaxed);
+        active = workers.size();
+        ++generation;
+    }
+    start_cv.notify_all();
+    work();
+
+    unique_lock lock(mtx);
+    done_cv.wait(lock, [this] {return active == 0;});
+}
+
+void ThreadPool::worker_loop() {
+    size_t seen = 0;
+    while (true) {
+        {
+            unique_lock lock(mtx);
+            start_cv.wait(lock, [&] {return stopping || generation != seen;});
+            if (stopping) {
+                return;
+            }
+            seen = generation;
+        }
+        work();
+        {
+            lock_guard lock(mtx);
+            if (--active == 0) {
+                done_cv.notify_one();
+            }
+        }
+    }
+}
@@ -33,14 +33,16 @@ ArgvParseResult parseArgs(char** argv) {
 
 const string& ArgvParseResult::get_option(const string& opt_name) {
     if (!named.contains(opt_name)) {
-        if(opt_name == "savefile"){
-            return "";
-        }
-        else{
-            stringstream ss;
-            ss << "Опция " << opt_name << " не найдена";
-            throw runtime_error(ss.str());
-        }
+        stringstream ss;
+        ss << "Опция " << opt_name << " не найдена";
+        throw runtime_error(ss.str());
+    }
+    return named.at(opt_name);
+}
+
+string ArgvParseResult::get_option(const string& opt_name, const string& default_value) {
+    if (!named.contains(opt_name)) {
+        return default_value;
     }
     return named.at(opt_name);
 }
@@ -7,18 +7,15 @@ int main(int argc, char** argv) {
     const string PType      = opts.get_option("p-type");
     const string VType      = opts.get_option("v-type");
     const string VFType     = opts.get_option("v-flow-type");
-    const string filename   = opts.get_option("file");
+    const FluidOptions fluid_opts = parseFluidOptions(opts);
 
-    using types = type_list<TYPES>;
-    using types_product = product<types, types, types>::type;
+    const string size       = read_field_size(fluid_opts.filename);
 
-    bool need_save;
-    const string save_filename = opts.get_option("savefile");
-    if(save_filename == ""){need_save = false;}
-    else {need_save = true;}
+    using sizes = size_markers<SIZES>::type;
+    using types_product = product_with<type_combos, sizes>::type;
 
-    Simulator sim{filename, need_save, save_filename};
-    bool impl_found = run_for_matching<Simulator, types_product>{}(sim, {PType, VType, VFType});
+    Simulator sim{fluid_opts};
+    bool impl_found = run_for_matching<Simulator, types_product>{}(sim, {PType, VType, VFType, size});
 
     if (!impl_found) {cerr << "Типы не найдены" << endl;}
 }
@@ -0,0 +1,393 @@
+#include "Simulator.hpp"
+
+#include <sys/wait.h>
+#include <unistd.h>
+
+#include <algorithm>
+#include <chrono>
+#include <cstdio>
+#include <filesystem>
+#include <fstream>
+#include <iostream>
+#include <numeric>
+#include <random>
+#include <sstream>
+#include <string>
+#include <vector>
+
+using namespace std;
+
+// Benchmarks the phases of Fluid::run for every type combination (COMBOS,
+// or all of TYPES) and every SIZES entry, and the arithmetic operators of
+// the numeric types:
+//     fluid-bench [--warmup=20] [--reps=20] [--threads=1] [--out=bench.json]
+//                 [--p-type=T] [--v-type=T] [--v-flow-type=T] [--size=N,M]
+//                 [--file=map.in]
+// A synthetic map is generated for every size unless --file gives one.
+// Every combination runs in a child process, so a failed assertion only
+// marks that combination as failed. Times are reported in microseconds.
+
+/// BenchAccess
+/// Runs single phases of a Fluid and saves/restores its per-cell state.
+struct BenchAccess {
+    static constexpr const char* phase_names[] = {
+        "external_forces",
+        "p_forces",
+        "flow",
+        "recalculate_p",
+        "move",
+    };
+    static constexpr size_t phase_count = size(phase_names);
+
+    template<typename F>
+    static void begin_tick(F& f, size_t tick) {
+        f.total_delta_p = 0;
+        f.tick_key = Rnd::key(f.seed, tick);
+    }
+
+    template<typename F>
+    static void phase(F& f, size_t k) {
+        switch (k) {
+            case 0: f.apply_external_forces(); break;
+            case 1: f.apply_p_forces(); break;
+            case 2: f.make_flow(); break;
+            case 3: f.recalculate_p(); break;
+            case 4: f.move_particles(); break;
+        }
+    }
+
+    template<typename F>
+    static void tick(F& f, size_t tick) {
+        begin_tick(f, tick);
+        for (size_t k = 0; k < phase_count; ++k) {
+            phase(f, k);
+        }
+    }
+
+    /// Raw bytes of every array a tick reads before writing.
+    template<typename F>
+    static vector<pair<char*, size_t>> state(F& f) {
+        // All per-cell arrays live in the arena, including velocity_flow,
+        // which a flow run on its own leaves set.
+        return {
+            {f.arena.data(), f.arena.size()},
+            {reinterpret_cast<char*>(&f.UT), sizeof(f.UT)},
+        };
+    }
+};
+
+namespace {
+
+template<typename M>
+struct marker_name;
+
+template<>
+struct marker_name<double_type_marker> {
+    static string get() {return "DOUBLE";}
+};
+
+template<>
+struct marker_name<float_type_marker> {
+    static string get() {return "FLOAT";}
+};
+
+template<size_t N, size_t K>
+struct marker_name<fixed_type_marker<N, K>> {
+    static string get() {return "FIXED(" + to_string(N) + ", " + to_string(K) + ")";}
+};
+
+template<size_t N, size_t K>
+struct marker_name<fast_fixed_type_marker<N, K>> {
+    static string get() {return "FAST_FIXED(" + to_string(N) + ", " + to_string(K) + ")";}
+};
+
+template<size_marker SZ>
+struct marker_name<static_size_marker<SZ>> {
+    static string get() {return to_string(SZ.n) + "," + to_string(SZ.m);}
+};
+
+struct BenchOptions {
+    size_t  warmup = 20;
+    size_t  reps = 20;
+    size_t  threads = 1;
+    string  p_type, v_type, v_flow_type, size;
+    string  file;
+};
+
+// Median, percentiles and extremes of a sample in microseconds, as JSON.
+string stats_json(vector<double> samples) {
+    sort(samples.begin(), samples.end());
+    auto percentile = [&](double q) {
+        return samples[min(samples.size() - 1, size_t(q * (samples.size() - 1) + 0.5))];
+    };
+    double mean = accumulate(samples.begin(), samples.end(), 0.0) / samples.size();
+    stringstream ss;
+    ss << "{\"median\": " << percentile(0.5)
+       << ", \"p10\": " << percentile(0.1)
+       << ", \"p90\": " << percentile(0.9)
+       << ", \"p99\": " << percentile(0.99)
+       << ", \"min\": " << samples.front()
+       << ", \"max\": " << samples.back()
+       << ", \"mean\": " << mean << "}";
+    return ss.str();
+}
+
+template<typename F>
+double time_us(F&& f) {
+    auto start = chrono::steady_clock::now();
+    f();
+    return chrono::duration<double, micro>(chrono::steady_clock::now() - start).count();
+}
+
+// Walls around the border and a baffle in the middle, water in the lower
+// half and air above it.
+string synthetic_map(size_t n, size_t m) {
+    auto path = filesystem::temp_directory_path() / ("fluid-bench-" + to_string(n) + "x" + to_string(m) + ".in");
+    ofstream out(path);
+    out << "0\n" << n << " " << m << "\n";
+    for (size_t x = 0; x < n; ++x) {
+        for (size_t y = 0; y < m; ++y) {
+            bool wall = x == 0 || y == 0 || x + 1 == n || y + 1 == m
+                     || (y == m / 2 && x > n / 4 && x + 2 < n);
+            out << (wall ? '#' : x > n / 2 ? '.' : ' ');
+        }
+        out << "\n";
+    }
+    out << "0.1\n  0.01\n. 1000\n";
+    return path.string();
+}
+
+// Runs `body` in a child process and returns what it wrote, or an error
+// object if the child did not finish normally.
+template<typename F>
+string isolated(F&& body) {
+    int fds[2];
+    if (pipe(fds) != 0) {
+        throw runtime_error("Не удалось создать канал");
+    }
+    cout.flush();
+    pid_t pid = fork();
+    if (pid == 0) {
+        close(fds[0]);
+        string ans;
+        try {
+            ans = body();
+        } catch (const exception& e) {
+            ans = "{\"error\": \"" + string(e.what()) + "\"}";
+        }
+        size_t written = 0;
+        while (written < ans.size()) {
+            ssize_t k = write(fds[1], ans.data() + written, ans.size() - written);
+            if (k <= 0) {
+                break;
+            }
+            written += k;
+        }
+        _exit(0);
+    }
+    close(fds[1]);
+    string ans;
+    char buffer[4096];
+    ssize_t k;
+    while ((k = read(fds[0], buffer, sizeof(buffer))) > 0) {
+        ans.append(buffer, k);
+    }
+    close(fds[0]);
+    int status = 0;
+    waitpid(pid, &status, 0);
+    if (!WIFEXITED(status) || WEXITSTATUS(status) != 0) {
+        stringstream ss;
+        ss << "{\"error\": \"процесс завершился аварийно";
+        if (WIFSIGNALED(status)) {
+            ss << ", сигнал " << WTERMSIG(status);
+        }
+        ss << "\"}";
+        return ss.str();
+    }
+    return ans;
+}
+
+struct PhaseBench {
+    const BenchOptions& opts;
+    vector<string> results;
+
+    template<typename PM, typename VM, typename VFM, typename SM>
+    void execute() {
+        const string p_name = marker_name<PM>::get(), v_name = marker_name<VM>::get();
+        const string vf_name = marker_name<VFM>::get(), size_name = marker_name<SM>::get();
+        if ((!opts.p_type.empty() && !PM{}.matches(opts.p_type))
+            || (!opts.v_type.empty() && !VM{}.matches(opts.v_type))
+            || (!opts.v_flow_type.empty() && !VFM{}.matches(opts.v_flow_type))
+            || (!opts.size.empty() && !SM{}.matches(opts.size))) {
+            return;
+        }
+
+        string filename = opts.file;
+        if (filename.empty()) {
+            auto comma = size_name.find(',');
+            filename = synthetic_map(stoull(size_name.substr(0, comma)), stoull(size_name.substr(comma + 1)));
+        } else if (!SM{}.matches(read_field_size(filename))) {
+            return;
+        }
+
+        string body = isolated([&] {
+            return run<typename PM::type, typename VM::type, typename VFM::type, typename SM::type>(filename);
+        });
+        cerr << p_name << " " << v_name << " " << vf_name << " " << size_name << endl;
+        results.push_back("{\"p_type\": \"" + p_name + "\", \"v_type\": \"" + v_name
+                        + "\", \"v_flow_type\": \"" + vf_name + "\", \"size\": \"" + size_name
+                        + "\", \"result\": " + body + "}");
+    }
+
+    template<typename P, typename V, typename VF, typename Storage>
+    string run(const string& filename) {
+        FluidOptions fluid_opts;
+        fluid_opts.filename = filename;
+        fluid_opts.threads = opts.threads;
+        fluid_opts.output = OutputMode::None;
+        Fluid<P, V, VF, Storage> fluid(fluid_opts);
+
+        size_t tick = 0;
+        for (; tick < opts.warmup; ++tick) {
+            BenchAccess::tick(fluid, tick);
+        }
+
+        auto spans = BenchAccess::state(fluid);
+        vector<vector<char>> saved;
+        for (auto [data, bytes] : spans) {
+            saved.emplace_back(data, data + bytes);
+        }
+        auto restore = [&] {
+            for (size_t k = 0; k < spans.size(); ++k) {
+                copy(saved[k].begin(), saved[k].end(), spans[k].first);
+            }
+        };
+
+        stringstream ss;
+        ss << "{";
+        // Every phase starts from the saved state with the phases before it
+        // replayed untimed, so it sees the same input on every repetition.
+        for (size_t k = 0; k < BenchAccess::phase_count; ++k) {
+            vector<double> samples;
+            for (size_t r = 0; r < opts.reps; ++r) {
+                restore();
+                BenchAccess::begin_tick(fluid, tick);
+                for (size_t j = 0; j < k; ++j) {
+                    BenchAccess::phase(fluid, j);
+                }
+                samples.push_back(time_us([&] {BenchAccess::phase(fluid, k);}));
+            }
+            ss << "\"" << BenchAccess::phase_names[k] << "\": " << stats_json(samples) << ", ";
+        }
+        vector<double> samples;
+        for (size_t r = 0; r < opts.reps; ++r) {
+            restore();
+            samples.push_back(time_us([&] {BenchAccess::tick(fluid, tick);}));
+        }
+        ss << "\"tick\": " << stats_json(samples) << "}";
+        return ss.str();
+    }
+};
+
+struct OperatorBench {
+    const BenchOptions& opts;
+    vector<string> results;
+
+    template<typename M>
+    void execute() {
+        using T = typename M::type;
+        constexpr size_t count = 4096;
+        mt19937 gen(1);
+        uniform_real_distribution<double> dist(0.5, 2.0);
+        vector<T> a(count), b(count), c(count);
+        for (size_t i = 0; i < count; ++i) {
+            a[i] = T(dist(gen));
+            b[i] = T(dist(gen));
+        }
+
+        auto bench = [&](const char* op, auto f) {
+            vector<double> samples;
+            for (size_t r = 0; r < opts.reps; ++r) {
+                samples.push_back(time_us([&] {
+                    for (size_t i = 0; i < count; ++i) {
+                        c[i] = f(a[i], b[i]);
+                    }
+                }) * 1000 / count);
+                // Keeps the results observable.
+                volatile double sink = double(c[r % count]);
+                (void) sink;
+            }
+            results.push_back("{\"type\": \"" + marker_name<M>::get() + "\", \"op\": \"" + op
+                            + "\", \"ns_per_op\": " + stats_json(samples) + "}");
+        };
+        bench("+", [](T x, T y) -> T {return x + y;});
+        bench("-", [](T x, T y) -> T {return x - y;});
+        bench("*", [](T x, T y) -> T {return x * y;});
+        bench("/", [](T x, T y) -> T {return x / y;});
+        bench("<", [](T x, T y) -> T {return x < y ? x : y;});
+    }
+};
+
+template<typename... Ts>
+struct wrap_each;
+
+template<typename... Ts>
+struct wrap_each<type_list<Ts...>> {
+    using type = type_list<type_list<Ts>...>;
+};
+
+string join(const vector<string>& items) {
+    string ans;
+    for (size_t i = 0; i < items.size(); ++i) {
+        ans += (i ? ",\n    " : "\n    ") + items[i];
+    }
+    return ans + "\n  ";
+}
+
+size_t parse_count(ArgvParseResult& args, const string& name, const string& default_value) {
+    const string value = args.get_option(name, default_value);
+    size_t ans = stoull(value);
+    if (ans == 0) {
+        throw runtime_error("Неверное значение опции " + name + ": " + value);
+    }
+    return ans;
+}
+
+}
+
+int main(int argc, char** argv) {
+    ArgvParseResult args = parseArgs(argv);
+    BenchOptions opts;
+    opts.warmup      = parse_count(args, "warmup", "20");
+    opts.reps        = parse_count(args, "reps", "20");
+    opts.threads     = parse_count(args, "threads", "1");
+    opts.p_type      = args.get_option("p-type", "");
+    opts.v_type      = args.get_option("v-type", "");
+    opts.v_flow_type = args.get_option("v-flow-type", "");
+    opts.size        = args.get_option("size", "");
+    opts.file        = args.get_option("file", "");
+
+    using types = unique_types<flatten<type_combos>::type>::type;
+    using sizes = size_markers<SIZES>::static_type;
+
+    PhaseBench phases{opts};
+    run_for_each<PhaseBench, product_with<type_combos, sizes>::type>{}(phases);
+
+    OperatorBench operators{opts};
+    run_for_each<OperatorBench, wrap_each<types>::type>{}(operators);
+
+    stringstream json;
+    json << "{\n"
+         << "  \"config\": {\"warmup\": " << opts.warmup << ", \"reps\": " << opts.reps
+         << ", \"threads\": " << opts.threads << ", \"unit\": \"us\"},\n"
+         << "  \"phases\": [" << join(phases.results) << "],\n"
+         << "  \"operators\": [" << join(operators.results) << "]\n"
+         << "}\n";
+
+    const string out = args.get_option("out", "");
+    if (out.empty()) {
+        cout << json.str();
+    } else {
+        ofstream(out) << json.str();
+    }
+}
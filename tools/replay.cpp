@@ -0,0 +1,37 @@
+#include "Recording.hpp"
+#include "Output.hpp"
+#include "argv_parse.hpp"
+
+#include <iostream>
+#include <stdexcept>
+#include <string>
+
+using namespace std;
+
+// Replays a recording made with --record in the text frame format:
+//     fluid-replay --file=run.rec [--from=T] [--to=T]
+// prints the frames of ticks T with from <= T < to; --info prints the header.
+int main(int argc, char** argv) {
+    ArgvParseResult opts = parseArgs(argv);
+    RecordingReader reader(opts.get_option("file"));
+    const auto& header = reader.header;
+
+    if (opts.get_option("info", "0") == "1") {
+        cout << "N, M: " << header.n << " " << header.m << "\n"
+             << "Начальный тик: " << header.start_tick << "\n"
+             << "Ключевой кадр каждые " << header.keyframe_every << " тиков\n"
+             << "P и velocity в ключевых кадрах: " << (header.full_keyframes ? "да" : "нет") << endl;
+        return 0;
+    }
+
+    const size_t from = stoull(opts.get_option("from", to_string(header.start_tick)));
+    const size_t to   = stoull(opts.get_option("to", to_string(size_t(-1))));
+
+    reader.seek(from);
+    auto sink = make_output_sink(OutputMode::Text, nullptr);
+    const FieldView view{reader.field().data(), header.m, header.n, header.m};
+    size_t tick;
+    while (reader.next(tick) && tick < to) {
+        sink->frame(tick, view);
+    }
+}